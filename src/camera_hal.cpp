@@ -1,10 +1,23 @@
 #include <esp_err.h>
+#include <esp_timer.h>
 #include "camera_hal.h"
+#include "frame.h"
 #include "pinout_sense_camera.h"
 
 class CameraConfig;
 
-//public 
+camera_buffer_config_t CameraHal::buffer_config = { 2, CAMERA_GRAB_LATEST, CAMERA_FB_IN_PSRAM, 20000000 };
+framesize_t CameraHal::frame_size = FRAMESIZE_UXGA;
+pixformat_t CameraHal::pixel_format = PIXFORMAT_JPEG;
+int CameraHal::jpeg_quality = 10;
+volatile bool CameraHal::reconfiguring = false;
+volatile int CameraHal::frames_out = 0;
+portMUX_TYPE CameraHal::frames_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// how long reconfigure waits for consumers to hand their frame buffers back
+#define RECONFIGURE_DRAIN_TIMEOUT_MS 5000
+
+//public
 
 esp_err_t CameraHal::init() {
     camera_config_t config = create_config();
@@ -21,10 +34,189 @@ sensor_t* CameraHal::get_sensor() {
     return esp_camera_sensor_get();
 }
 
+camera_fb_t* CameraHal::frame_get() {
+    // wait for any reconfigure to finish, then count ourselves in before
+    // touching the driver so reconfigure cannot pull it out from under us
+    while (true) {
+        portENTER_CRITICAL(&frames_lock);
+        if (!reconfiguring) {
+            frames_out++;
+            portEXIT_CRITICAL(&frames_lock);
+            break;
+        }
+        portEXIT_CRITICAL(&frames_lock);
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb) {
+        portENTER_CRITICAL(&frames_lock);
+        frames_out--;
+        portEXIT_CRITICAL(&frames_lock);
+    }
+    return fb;
+}
+
+void CameraHal::frame_return(camera_fb_t *fb) {
+    if (!fb) {
+        return;
+    }
+    esp_camera_fb_return(fb);
+
+    portENTER_CRITICAL(&frames_lock);
+    frames_out--;
+    portEXIT_CRITICAL(&frames_lock);
+}
+
+esp_err_t CameraHal::reconfigure(const camera_buffer_config_t &buffers) {
+    if (buffers.fb_count < 1 || buffers.fb_count > 4) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return reinit(buffers, pixel_format, FRAMESIZE_INVALID);
+}
+
+esp_err_t CameraHal::set_format(pixformat_t format, framesize_t size) {
+    if (format != PIXFORMAT_JPEG && frame_bytes_per_pixel(format) == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (size > FRAMESIZE_INVALID) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return reinit(buffer_config, format, size);
+}
+
+bool CameraHal::is_reconfiguring() {
+    return reconfiguring;
+}
+
+pixformat_t CameraHal::get_format() {
+    return pixel_format;
+}
+
+camera_buffer_config_t CameraHal::get_buffer_config() {
+    return buffer_config;
+}
+
+esp_err_t CameraHal::benchmark(uint32_t frames, camera_bench_result_t *result) {
+    *result = {};
+    uint64_t latency_sum = 0;
+    uint64_t wait_sum = 0;
+    uint64_t bytes_sum = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < frames; i++) {
+        int64_t t0 = esp_timer_get_time();
+        camera_fb_t *fb = frame_get();
+        int64_t t1 = esp_timer_get_time();
+
+        if (!fb) {
+            result->failures++;
+            continue;
+        }
+
+        // the driver stamps the frame with esp_timer time at VSYNC
+        int64_t captured = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+        uint32_t latency = (t1 > captured) ? (uint32_t)(t1 - captured) : 0;
+
+        latency_sum += latency;
+        if (latency > result->latency_max_us) {
+            result->latency_max_us = latency;
+        }
+        wait_sum += t1 - t0;
+        bytes_sum += fb->len;
+        result->frames++;
+
+        frame_return(fb);
+    }
+    result->elapsed_us = (uint32_t)(esp_timer_get_time() - start);
+
+    if (result->frames == 0) {
+        return ESP_FAIL;
+    }
+    result->fps = result->frames * 1000000.0f / result->elapsed_us;
+    result->latency_avg_us = latency_sum / result->frames;
+    result->wait_avg_us = wait_sum / result->frames;
+    result->bytes_avg = bytes_sum / result->frames;
+    return ESP_OK;
+}
+
 //private
 
+// Drain every frame buffer, then bring the driver back up with new buffers,
+// pixel format or frame size. FRAMESIZE_INVALID keeps the current size.
+esp_err_t CameraHal::reinit(const camera_buffer_config_t &buffers, pixformat_t format, framesize_t size) {
+    portENTER_CRITICAL(&frames_lock);
+    if (reconfiguring) {
+        portEXIT_CRITICAL(&frames_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    reconfiguring = true;
+    portEXIT_CRITICAL(&frames_lock);
+
+    // wait for every frame buffer to come back, streams will block in frame_get meanwhile
+    int64_t deadline = esp_timer_get_time() + RECONFIGURE_DRAIN_TIMEOUT_MS * 1000LL;
+    while (frames_out > 0) {
+        if (esp_timer_get_time() > deadline) {
+            reconfiguring = false;
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+
+    // remember what the sensor was doing, deinit resets it to defaults
+    sensor_t *sensor = esp_camera_sensor_get();
+    camera_status_t status = sensor->status;
+    framesize_t previous_size = status.framesize;
+    if (size != FRAMESIZE_INVALID) {
+        status.framesize = size;
+    }
+    jpeg_quality = status.quality;
+
+    camera_buffer_config_t previous = buffer_config;
+    pixformat_t previous_format = pixel_format;
+    buffer_config = buffers;
+    pixel_format = format;
+    frame_size = status.framesize;
+    if (buffer_config.xclk_freq_hz == 0) {
+        buffer_config.xclk_freq_hz = sensor->xclk_freq_hz;
+    }
+    // raw frames are handed out without a copy, with a single buffer the driver would starve
+    if (pixel_format != PIXFORMAT_JPEG && buffer_config.fb_count < 2) {
+        buffer_config.fb_count = 2;
+    }
+
+    Serial.printf("Camera reconfigure: fb_count=%u grab_mode=%d fb_location=%d xclk=%d format=%d framesize=%d\n",
+        (unsigned)buffer_config.fb_count, buffer_config.grab_mode, buffer_config.fb_location, buffer_config.xclk_freq_hz,
+        pixel_format, frame_size);
+
+    esp_camera_deinit();
+    camera_config_t config = create_config();
+    esp_err_t err = esp_camera_init(&config);
+    if (err != ESP_OK) {
+        // e.g. not enough DRAM for the requested buffers, go back to what worked
+        Serial.printf("Camera reconfigure failed with error 0x%x, restoring previous config\n", err);
+        buffer_config = previous;
+        pixel_format = previous_format;
+        frame_size = previous_size;
+        status.framesize = previous_size;
+        config = create_config();
+        if (esp_camera_init(&config) != ESP_OK) {
+            Serial.println("Camera restore failed");
+        }
+    }
+
+    sensor = esp_camera_sensor_get();
+    if (sensor) {
+        restore_sensor(sensor, status);
+    }
+
+    reconfiguring = false;
+    return err;
+}
+
+
 camera_config_t CameraHal::create_config() {
-    
+
     //The Xiao Sense has PSRAM, so no need to limit frame size
     camera_config_t config;
     config.ledc_channel = LEDC_CHANNEL_0;
@@ -45,17 +237,45 @@ camera_config_t CameraHal::create_config() {
     config.pin_sccb_scl = SIOC_GPIO_NUM;
     config.pin_pwdn = PWDN_GPIO_NUM;
     config.pin_reset = RESET_GPIO_NUM;
-    config.xclk_freq_hz = 20000000;
-    config.frame_size = FRAMESIZE_UXGA;
-    config.pixel_format = PIXFORMAT_JPEG;
-    config.grab_mode = CAMERA_GRAB_LATEST;
-    config.fb_location = CAMERA_FB_IN_PSRAM;
-    config.jpeg_quality = 10;
-    config.fb_count = 2;
+    config.xclk_freq_hz = buffer_config.xclk_freq_hz;
+    config.frame_size = frame_size;
+    config.pixel_format = pixel_format;
+    config.grab_mode = buffer_config.grab_mode;
+    config.fb_location = buffer_config.fb_location;
+    config.jpeg_quality = jpeg_quality;
+    config.fb_count = buffer_config.fb_count;
 
     return config;
 }
 
 void CameraHal::configure_sensor(sensor_t* sensor) {
     sensor->set_framesize(sensor, FRAMESIZE_UXGA);
-}
\ No newline at end of file
+}
+
+// Put back the user visible settings after the driver was reinitialised
+void CameraHal::restore_sensor(sensor_t* sensor, const camera_status_t &status) {
+    sensor->set_framesize(sensor, status.framesize);
+    sensor->set_quality(sensor, status.quality);
+    sensor->set_brightness(sensor, status.brightness);
+    sensor->set_contrast(sensor, status.contrast);
+    sensor->set_saturation(sensor, status.saturation);
+    sensor->set_special_effect(sensor, status.special_effect);
+    sensor->set_whitebal(sensor, status.awb);
+    sensor->set_awb_gain(sensor, status.awb_gain);
+    sensor->set_wb_mode(sensor, status.wb_mode);
+    sensor->set_exposure_ctrl(sensor, status.aec);
+    sensor->set_aec2(sensor, status.aec2);
+    sensor->set_ae_level(sensor, status.ae_level);
+    sensor->set_aec_value(sensor, status.aec_value);
+    sensor->set_gain_ctrl(sensor, status.agc);
+    sensor->set_agc_gain(sensor, status.agc_gain);
+    sensor->set_gainceiling(sensor, (gainceiling_t)status.gainceiling);
+    sensor->set_bpc(sensor, status.bpc);
+    sensor->set_wpc(sensor, status.wpc);
+    sensor->set_raw_gma(sensor, status.raw_gma);
+    sensor->set_lenc(sensor, status.lenc);
+    sensor->set_hmirror(sensor, status.hmirror);
+    sensor->set_vflip(sensor, status.vflip);
+    sensor->set_dcw(sensor, status.dcw);
+    sensor->set_colorbar(sensor, status.colorbar);
+}
@@ -26,15 +26,72 @@ static inline const char *camera_model_name(uint16_t pid) {
     }
 }
 
+// Driver frame buffer settings that can be changed at runtime with CameraHal::reconfigure
+typedef struct {
+    size_t fb_count;                  // number of driver frame buffers (1-4)
+    camera_grab_mode_t grab_mode;     // CAMERA_GRAB_LATEST for low latency, CAMERA_GRAB_WHEN_EMPTY for no drops
+    camera_fb_location_t fb_location; // PSRAM or internal DRAM
+    int xclk_freq_hz;                 // sensor master clock, 0 keeps the current clock
+} camera_buffer_config_t;
+
+// Lowest latency: always hand out the newest frame, old ones are overwritten
+#define CAMERA_BUFFERS_LOW_LATENCY { 2, CAMERA_GRAB_LATEST, CAMERA_FB_IN_PSRAM, 0 }
+// No drops: the driver only fills empty buffers and queues them in order
+#define CAMERA_BUFFERS_NO_DROPS { 4, CAMERA_GRAB_WHEN_EMPTY, CAMERA_FB_IN_PSRAM, 0 }
+
+typedef struct {
+    uint32_t frames;         // frames captured
+    uint32_t failures;       // esp_camera_fb_get returned NULL
+    uint32_t elapsed_us;     // wall time of the whole run
+    float fps;
+    uint32_t latency_avg_us; // age of the frame (since VSYNC) when it was handed to us
+    uint32_t latency_max_us;
+    uint32_t wait_avg_us;    // time spent blocked in esp_camera_fb_get
+    uint32_t bytes_avg;
+} camera_bench_result_t;
+
 
 class CameraHal {
   public:
     static esp_err_t init();
     static sensor_t* get_sensor();
+
+    // Use these instead of esp_camera_fb_get / esp_camera_fb_return, so
+    // reconfigure knows when every frame buffer is back with the driver.
+    // frame_get waits while a reconfigure is in progress.
+    static camera_fb_t* frame_get();
+    static void frame_return(camera_fb_t *fb);
+
+    // Deinit and reinit the driver with a new buffer configuration, keeping the sensor settings.
+    // Callers of frame_get are held off until the camera is back up.
+    static esp_err_t reconfigure(const camera_buffer_config_t &buffers);
+    static camera_buffer_config_t get_buffer_config();
+
+    // Switch between JPEG and the raw formats (grayscale, YUV422, RGB565), same drain and
+    // reinit as reconfigure. Raw frames are width * height * bytes per pixel, so large
+    // frame sizes need the buffers in PSRAM. FRAMESIZE_INVALID keeps the current size.
+    static esp_err_t set_format(pixformat_t format, framesize_t size);
+    static pixformat_t get_format();
+
+    // True while reconfigure or set_format waits for the frame buffers to come back
+    static bool is_reconfiguring();
+
+    // Capture a number of frames back to back and report fps and latency
+    static esp_err_t benchmark(uint32_t frames, camera_bench_result_t *result);
+
   private:
+    static esp_err_t reinit(const camera_buffer_config_t &buffers, pixformat_t format, framesize_t size);
     static camera_config_t create_config();
     static void configure_sensor(sensor_t* sensor);
+    static void restore_sensor(sensor_t* sensor, const camera_status_t &status);
 
+    static camera_buffer_config_t buffer_config;
+    static framesize_t frame_size;
+    static pixformat_t pixel_format;
+    static int jpeg_quality;
+    static volatile bool reconfiguring;
+    static volatile int frames_out;
+    static portMUX_TYPE frames_lock;
 };
 
-#endif // CAMERA_HAL_H
\ No newline at end of file
+#endif // CAMERA_HAL_H
@@ -0,0 +1,205 @@
+#include <mutex>
+#include <esp_timer.h>
+#include "capture_task.h"
+#include "camera_hal.h"
+#include "frame_channel.h"
+#include "sensor_queue.h"
+#include "wall_clock.h"
+#include "task_config.h"
+#include "task_monitor.h"
+
+TaskHandle_t CaptureTask::task = NULL;
+frame_stage_t CaptureTask::stages[CAPTURE_MAX_STAGES];
+int CaptureTask::stage_count = 0;
+volatile int CaptureTask::pause_count = 0;
+volatile bool CaptureTask::idle = false;
+capture_stats_t CaptureTask::stats = {};
+
+// guards the pause count and stats
+static std::mutex state_lock;
+// JPEG frames, either straight from the sensor or encoded by the PreviewEncoder, with a short history
+static FrameChannel jpeg_frames(FRAME_HISTORY_DEPTH, FRAME_HISTORY_MAX_BYTES);
+// raw frames, still sitting in the driver buffer
+static FrameChannel raw_frames;
+static uint32_t next_seq = 1;
+
+// how long pause waits for the task to let go of the camera
+#define PAUSE_TIMEOUT_MS 3000
+
+//public
+
+esp_err_t CaptureTask::start() {
+    BaseType_t res = xTaskCreatePinnedToCore(run, "capture", CAPTURE_TASK_STACK, NULL,
+                                             CAPTURE_TASK_PRIORITY, &task, CAPTURE_CORE);
+    TaskMonitor::watch(task);
+    return res == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+void CaptureTask::pause() {
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        pause_count++;
+    }
+    if (!task) {
+        return;
+    }
+
+    // the task notices on its next loop, which is at most one frame away
+    int64_t deadline = esp_timer_get_time() + PAUSE_TIMEOUT_MS * 1000LL;
+    while (!idle && esp_timer_get_time() < deadline) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+}
+
+void CaptureTask::resume() {
+    std::lock_guard<std::mutex> guard(state_lock);
+    if (pause_count > 0) {
+        pause_count--;
+    }
+}
+
+bool CaptureTask::add_stage(frame_stage_t stage) {
+    if (task || stage_count >= CAPTURE_MAX_STAGES) {
+        return false;
+    }
+    stages[stage_count++] = stage;
+    return true;
+}
+
+frame_t *CaptureTask::acquire_next(uint32_t after_seq, uint32_t timeout_ms) {
+    return jpeg_frames.acquire_next(after_seq, timeout_ms);
+}
+
+frame_t *CaptureTask::acquire_next_raw(uint32_t after_seq, uint32_t timeout_ms) {
+    return raw_frames.acquire_next(after_seq, timeout_ms);
+}
+
+frame_t *CaptureTask::acquire_after(uint32_t after_seq, uint32_t timeout_ms) {
+    return jpeg_frames.acquire_after(after_seq, timeout_ms);
+}
+
+frame_t *CaptureTask::acquire_nearest(const struct timeval &at, uint32_t timeout_ms, int64_t *delta_us) {
+    return jpeg_frames.acquire_nearest(at, timeout_ms, delta_us);
+}
+
+void CaptureTask::release(frame_t *frame) {
+    frame_release(frame);
+}
+
+uint32_t CaptureTask::latest_seq() {
+    return jpeg_frames.latest_seq();
+}
+
+uint32_t CaptureTask::latest_raw_seq() {
+    return raw_frames.latest_seq();
+}
+
+uint32_t CaptureTask::oldest_seq() {
+    return jpeg_frames.oldest_seq();
+}
+
+void CaptureTask::publish_jpeg(frame_t *frame) {
+    jpeg_frames.publish(frame);
+}
+
+capture_stats_t CaptureTask::get_stats() {
+    std::lock_guard<std::mutex> guard(state_lock);
+    return stats;
+}
+
+int CaptureTask::write_metrics(char *out, size_t len) {
+    capture_stats_t s = get_stats();
+    return snprintf(out, len,
+        "\"capture\":{\"core\":%d,\"published\":%u,\"last_seq\":%u,\"capture_failures\":%u,"
+        "\"dropped_no_mem\":%u,\"dropped_stage\":%u,\"busy_us\":%llu,\"history_oldest_seq\":%u}",
+        CAPTURE_CORE, s.published, s.last_seq, s.capture_failures,
+        s.dropped_no_mem, s.dropped_stage, (unsigned long long)s.busy_us, jpeg_frames.oldest_seq());
+}
+
+//private
+
+void CaptureTask::run(void *arg) {
+    while (true) {
+        // a raw frame keeps its driver buffer, let go of it so a reconfigure can drain
+        if (pause_count > 0 || CameraHal::is_reconfiguring()) {
+            raw_frames.retire();
+        }
+        if (pause_count > 0) {
+            idle = true;
+            // whoever paused us may still need the sensor
+            SensorQueue::apply_pending(false);
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        idle = false;
+
+        camera_fb_t *fb = CameraHal::frame_get();
+
+        // the driver just handed over a finished frame, the next one is only starting,
+        // this is as close to VSYNC as we get: write the queued sensor commands now
+        SensorQueue::apply_pending(true);
+
+        if (!fb) {
+            std::lock_guard<std::mutex> guard(state_lock);
+            stats.capture_failures++;
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+
+        // JPEG is copied out of the driver buffer so it can be refilled while consumers
+        // take their time. Raw frames are far too big for that and are passed on as they are.
+        bool raw = fb->format != PIXFORMAT_JPEG;
+        frame_t *frame;
+        if (raw) {
+            frame = frame_wrap(fb);
+            if (!frame) {
+                CameraHal::frame_return(fb);
+            }
+        } else {
+            frame_t meta = {};
+            meta.width = fb->width;
+            meta.height = fb->height;
+            meta.format = fb->format;
+            meta.timestamp = fb->timestamp;
+            frame = frame_copy(fb->buf, fb->len, &meta);
+            CameraHal::frame_return(fb);
+        }
+
+        if (!frame) {
+            std::lock_guard<std::mutex> guard(state_lock);
+            stats.dropped_no_mem++;
+            continue;
+        }
+        // numbered before the stages run, so a frame a stage drops shows up as a gap
+        frame->seq = next_seq++;
+        WallClock::from_monotonic(frame->timestamp, &frame->wall);
+        SensorQueue::frame_started(frame->seq, frame->timestamp);
+
+        bool keep = true;
+        for (int i = 0; i < stage_count && keep; i++) {
+            keep = stages[i](frame);
+        }
+
+        int64_t busy = esp_timer_get_time() - start;
+
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            stats.busy_us += busy;
+            if (keep) {
+                stats.published++;
+                stats.last_seq = frame->seq;
+            } else {
+                stats.dropped_stage++;
+            }
+        }
+
+        if (!keep) {
+            frame_release(frame);
+        } else if (raw) {
+            raw_frames.publish(frame);
+        } else {
+            jpeg_frames.publish(frame);
+        }
+    }
+}
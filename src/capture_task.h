@@ -0,0 +1,88 @@
+#ifndef CAPTURE_TASK_H
+#define CAPTURE_TASK_H
+
+#include <Arduino.h>
+#include <esp_err.h>
+#include "frame.h"
+
+// A stage runs on the capture core for every frame before it is published.
+// Returning false drops the frame.
+typedef bool (*frame_stage_t)(frame_t *frame);
+
+#define CAPTURE_MAX_STAGES 4
+
+// Recent JPEG frames kept for /frame, by count and by the arena space they may hold on to.
+// The rest of the frame arena stays free for capture.
+#ifndef FRAME_HISTORY_DEPTH
+#define FRAME_HISTORY_DEPTH 8
+#endif
+
+#ifndef FRAME_HISTORY_MAX_BYTES
+#define FRAME_HISTORY_MAX_BYTES (1024 * 1024)
+#endif
+
+typedef struct {
+    uint32_t published;        // frames handed to consumers
+    uint32_t capture_failures; // esp_camera_fb_get returned NULL
+    uint32_t dropped_no_mem;   // no free descriptor or arena space for the copy
+    uint32_t dropped_stage;    // rejected by a stage
+    uint32_t last_seq;
+    uint64_t busy_us;          // time spent copying frames and running stages
+} capture_stats_t;
+
+// Owns the camera: a task pinned to CAPTURE_CORE pulls frames from the driver,
+// copies them into the frame arena so the driver buffer goes straight back,
+// runs the registered stages and publishes the result. HTTP handlers on the
+// network core only ever see published frames.
+//
+// In a raw pixel format the frames are published without a copy on a second
+// channel (acquire_next_raw) and hold their driver buffer until released.
+// The JPEG channel is then fed by the PreviewEncoder, if it runs.
+class CaptureTask {
+  public:
+    static esp_err_t start();
+
+    // Stop pulling frames from the driver, returns once the task no longer holds the camera.
+    // Calls nest, the task resumes when every pause has been matched by a resume.
+    static void pause();
+    static void resume();
+
+    // Register a stage, must be called before start
+    static bool add_stage(frame_stage_t stage);
+
+    // Wait up to timeout_ms for a frame newer than after_seq.
+    // The frame comes back with a reference held, hand it back with release.
+    static frame_t *acquire_next(uint32_t after_seq, uint32_t timeout_ms);
+    // Same for raw frames, release them quickly, every one holds a driver buffer
+    static frame_t *acquire_next_raw(uint32_t after_seq, uint32_t timeout_ms);
+    // From the JPEG history: the oldest frame newer than after_seq, or the one closest to a wall clock time.
+    // Both wait up to timeout_ms for frames that have not been captured yet, and return NULL
+    // if the frame asked for is still to come after that.
+    static frame_t *acquire_after(uint32_t after_seq, uint32_t timeout_ms);
+    static frame_t *acquire_nearest(const struct timeval &at, uint32_t timeout_ms, int64_t *delta_us);
+    static void release(frame_t *frame);
+
+    static uint32_t latest_seq();
+    static uint32_t latest_raw_seq();
+    static uint32_t oldest_seq();
+
+    // Publish a JPEG made from a raw frame, takes over the caller's reference
+    static void publish_jpeg(frame_t *frame);
+    static capture_stats_t get_stats();
+    static TaskHandle_t get_handle() { return task; }
+
+    // Write the "capture" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+
+  private:
+    static void run(void *arg);
+
+    static TaskHandle_t task;
+    static frame_stage_t stages[CAPTURE_MAX_STAGES];
+    static int stage_count;
+    static volatile int pause_count;
+    static volatile bool idle;
+    static capture_stats_t stats;
+};
+
+#endif // CAPTURE_TASK_H
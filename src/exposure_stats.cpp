@@ -0,0 +1,122 @@
+#include <mutex>
+#include <esp_timer.h>
+#include <img_converters.h>
+#include "exposure_stats.h"
+#include "mem_pool.h"
+
+uint8_t *ExposureStats::decode_buf = nullptr;
+volatile uint32_t ExposureStats::interval_ms = LUMA_DEFAULT_INTERVAL_MS;
+int64_t ExposureStats::last_run_us = 0;
+int64_t ExposureStats::last_compute_us = 0;
+
+static std::mutex stats_lock;
+static luma_stats_t latest_stats;
+static bool have_stats = false;
+
+//public
+
+esp_err_t ExposureStats::init() {
+    decode_buf = (uint8_t *)mem_region_alloc(LUMA_DECODE_MAX_PIXELS * 2, MEM_REGION_PSRAM);
+    return decode_buf ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+bool ExposureStats::stage(frame_t *frame) {
+    int64_t now = esp_timer_get_time();
+    int64_t wait_us = (int64_t)interval_ms * 1000;
+    int64_t budget_wait_us = last_compute_us * 100 / LUMA_MAX_CPU_PERCENT;
+    wait_us = budget_wait_us > wait_us ? budget_wait_us : wait_us;
+    if (interval_ms == 0 || now - last_run_us < wait_us) {
+        return true;
+    }
+    last_run_us = now;
+
+    luma_stats_t stats;
+    stats.seq = frame->seq;
+
+    switch (frame->format) {
+        case PIXFORMAT_JPEG: {
+            if (!decode_buf) {
+                return true;
+            }
+            // 1/8 is the cheapest scale by far and still leaves 40x30 of a QVGA frame
+            const int shift = 3;
+            int w = frame->width >> shift;
+            int h = frame->height >> shift;
+            if ((uint32_t)w * h > LUMA_DECODE_MAX_PIXELS) {
+                return true;
+            }
+            if (!jpg2rgb565(frame->buf, frame->len, decode_buf, (jpg_scale_t)shift)) {
+                // a broken frame, the integrity check deals with those
+                return true;
+            }
+            luma_stats_compute(decode_buf, w, h, w * 2, LUMA_FMT_RGB565_BE, 1, &stats);
+            break;
+        }
+        // raw frames need no decode, sample every 8th pixel of every 8th row instead
+        case PIXFORMAT_GRAYSCALE:
+            luma_stats_compute(frame->buf, frame->width, frame->height, frame->width, LUMA_FMT_GRAY, 8, &stats);
+            break;
+        case PIXFORMAT_YUV422:
+            luma_stats_compute(frame->buf, frame->width, frame->height, frame->width * 2, LUMA_FMT_YUYV, 8, &stats);
+            break;
+        case PIXFORMAT_RGB565:
+            luma_stats_compute(frame->buf, frame->width, frame->height, frame->width * 2, LUMA_FMT_RGB565_BE, 8, &stats);
+            break;
+        default:
+            return true;
+    }
+
+    stats.compute_us = (uint32_t)(esp_timer_get_time() - now);
+    last_compute_us = stats.compute_us;
+
+    std::lock_guard<std::mutex> guard(stats_lock);
+    latest_stats = stats;
+    have_stats = true;
+    return true;
+}
+
+bool ExposureStats::latest(luma_stats_t *out) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    if (!have_stats) {
+        return false;
+    }
+    *out = latest_stats;
+    return true;
+}
+
+int ExposureStats::write_json(char *out, size_t len, const luma_stats_t &stats) {
+    size_t n = 0;
+    #define LUMA_REMAINING() (n < len ? len - n : 0)
+    #define LUMA_OUT() (out + (n < len ? n : len))
+
+    n += snprintf(LUMA_OUT(), LUMA_REMAINING(),
+        "{\"seq\":%u,\"width\":%u,\"height\":%u,\"pixels\":%u,\"compute_us\":%u,"
+        "\"mean\":%u.%02u,\"clip_low_pct\":%u.%u,\"clip_high_pct\":%u.%u,\"zones\":[",
+        stats.seq, stats.width, stats.height, stats.pixels, stats.compute_us,
+        stats.mean_x100 / 100, stats.mean_x100 % 100,
+        stats.clip_low_permille / 10, stats.clip_low_permille % 10,
+        stats.clip_high_permille / 10, stats.clip_high_permille % 10);
+
+    for (int zy = 0; zy < LUMA_ZONES_Y; zy++) {
+        for (int zx = 0; zx < LUMA_ZONES_X; zx++) {
+            n += snprintf(LUMA_OUT(), LUMA_REMAINING(), "%s%u", (zy || zx) ? "," : "", stats.zones[zy][zx]);
+        }
+    }
+    n += snprintf(LUMA_OUT(), LUMA_REMAINING(), "],\"hist\":[");
+    for (int i = 0; i < LUMA_BINS; i++) {
+        n += snprintf(LUMA_OUT(), LUMA_REMAINING(), "%s%u", i ? "," : "", stats.hist[i]);
+    }
+    n += snprintf(LUMA_OUT(), LUMA_REMAINING(), "]}");
+
+    #undef LUMA_REMAINING
+    #undef LUMA_OUT
+
+    return n < len ? (int)n : (int)(len ? len - 1 : 0);
+}
+
+int ExposureStats::write_header(char *out, size_t len, const luma_stats_t &stats) {
+    return snprintf(out, len, "seq=%u;mean=%u.%02u;lo=%u.%u;hi=%u.%u",
+        stats.seq, stats.mean_x100 / 100, stats.mean_x100 % 100,
+        stats.clip_low_permille / 10, stats.clip_low_permille % 10,
+        stats.clip_high_permille / 10, stats.clip_high_permille % 10);
+}
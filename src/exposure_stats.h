@@ -0,0 +1,55 @@
+#ifndef EXPOSURE_STATS_H
+#define EXPOSURE_STATS_H
+
+#include <Arduino.h>
+#include <esp_err.h>
+#include "frame.h"
+#include "luma_stats.h"
+
+// Largest reduced image the JPEG decoder writes into (RGB565, 2 bytes per pixel).
+// 320x240 covers UXGA and QSXGA at 1/8 scale.
+#ifndef LUMA_DECODE_MAX_PIXELS
+#define LUMA_DECODE_MAX_PIXELS (320 * 240)
+#endif
+
+// Default shortest time between two stats updates, every frame at preview rates
+#ifndef LUMA_DEFAULT_INTERVAL_MS
+#define LUMA_DEFAULT_INTERVAL_MS 50
+#endif
+
+// Most of the capture core the stage may use. After an update it waits until the time
+// that update took is this share of the time since, so large frames get fewer updates
+// rather than a lower frame rate.
+#ifndef LUMA_MAX_CPU_PERCENT
+#define LUMA_MAX_CPU_PERCENT 10
+#endif
+
+// Capture stage that keeps luma statistics of recent frames up to date.
+// JPEG frames go through a 1/8 scale decode, which only needs the DC coefficient of
+// each block and no IDCT. Raw frames are subsampled directly.
+class ExposureStats {
+  public:
+    static esp_err_t init();
+
+    // Registered with CaptureTask::add_stage, never drops a frame
+    static bool stage(frame_t *frame);
+
+    // Copy of the most recent stats, false if nothing has been computed yet
+    static bool latest(luma_stats_t *out);
+
+    // 0 disables the stage
+    static void set_interval_ms(uint32_t ms) { interval_ms = ms; }
+    static uint32_t get_interval_ms() { return interval_ms; }
+
+    static int write_json(char *out, size_t len, const luma_stats_t &stats);
+    // Short summary for a stream part header, e.g. "seq=12;mean=98.31;lo=0.4;hi=2.1"
+    static int write_header(char *out, size_t len, const luma_stats_t &stats);
+
+  private:
+    static uint8_t *decode_buf;
+    static volatile uint32_t interval_ms;
+    static int64_t last_run_us;
+    static int64_t last_compute_us;
+};
+
+#endif // EXPOSURE_STATS_H
@@ -0,0 +1,61 @@
+#include <string.h>
+#include "frame.h"
+#include "camera_hal.h"
+#include "memory_manager.h"
+
+static_assert(sizeof(frame_t) <= MEM_DESCRIPTOR_SIZE, "frame_t must fit in a descriptor block");
+
+frame_t *frame_wrap(camera_fb_t *fb) {
+    frame_t *frame = (frame_t *)MemoryManager::descriptors().alloc();
+    if (!frame) {
+        return nullptr;
+    }
+
+    frame->buf = fb->buf;
+    frame->len = fb->len;
+    frame->width = fb->width;
+    frame->height = fb->height;
+    frame->format = fb->format;
+    frame->timestamp = fb->timestamp;
+    frame->seq = 0;
+    frame->fb = fb;
+    frame->refs = 1;
+    return frame;
+}
+
+frame_t *frame_copy(const uint8_t *buf, size_t len, const frame_t *like) {
+    frame_t *frame = (frame_t *)MemoryManager::descriptors().alloc();
+    if (!frame) {
+        return nullptr;
+    }
+
+    *frame = *like;
+    frame->buf = (uint8_t *)MemoryManager::frames().alloc(len);
+    if (!frame->buf) {
+        MemoryManager::descriptors().free(frame);
+        return nullptr;
+    }
+    memcpy(frame->buf, buf, len);
+    frame->len = len;
+    frame->fb = nullptr;
+    frame->refs = 1;
+    return frame;
+}
+
+frame_t *frame_ref(frame_t *frame) {
+    __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+void frame_release(frame_t *frame) {
+    if (!frame || __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    if (frame->fb) {
+        CameraHal::frame_return(frame->fb);
+    } else {
+        MemoryManager::frames().free(frame->buf);
+    }
+    MemoryManager::descriptors().free(frame);
+}
@@ -0,0 +1,65 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <sys/time.h>
+#include <esp_camera.h>
+
+// A captured frame that outlives esp_camera_fb_return.
+// The descriptor lives in MemoryManager::descriptors(). JPEG pixels are copied
+// into MemoryManager::frames(); raw frames are too large to copy, so they keep
+// the driver buffer (fb) and hand it back when the last reference is dropped.
+typedef struct {
+    uint8_t *buf;             // frame payload
+    size_t len;               // payload length in bytes
+    uint16_t width;
+    uint16_t height;
+    pixformat_t format;
+    uint32_t seq;             // capture sequence number, starts at 1 and never repeats, gaps are dropped frames
+    struct timeval timestamp; // driver timestamp taken at VSYNC (esp_timer time, not wall clock)
+    struct timeval wall;      // the same moment on the SNTP disciplined wall clock, see WallClock
+    camera_fb_t *fb;          // driver buffer for zero-copy frames, NULL when buf is in the frame arena
+    int refs;                 // use frame_ref / frame_release
+} frame_t;
+
+// Wrap a driver buffer without copying, the frame owns fb afterwards
+frame_t *frame_wrap(camera_fb_t *fb);
+// Copy a payload into the frame arena, the metadata is taken from like
+frame_t *frame_copy(const uint8_t *buf, size_t len, const frame_t *like);
+
+frame_t *frame_ref(frame_t *frame);
+// Drop a reference, the last one frees the copy or returns the driver buffer
+void frame_release(frame_t *frame);
+
+// Bytes per pixel of the raw formats, 0 for compressed ones
+static inline int frame_bytes_per_pixel(pixformat_t format) {
+    switch (format) {
+        case PIXFORMAT_GRAYSCALE: return 1;
+        case PIXFORMAT_YUV422:
+        case PIXFORMAT_RGB565:    return 2;
+        case PIXFORMAT_RGB888:    return 3;
+        default:                  return 0;
+    }
+}
+
+// Header in front of every frame on /raw, little endian like the ESP32 itself.
+// The pixel data follows directly, len bytes, rows stride bytes apart.
+#define RAW_HEADER_MAGIC "CRAW"
+#define RAW_HEADER_VERSION 1
+
+typedef struct __attribute__((packed)) {
+    char magic[4];      // RAW_HEADER_MAGIC
+    uint8_t version;    // RAW_HEADER_VERSION
+    uint8_t format;     // pixformat_t of the esp32-camera driver (RGB565 0, YUV422 1, GRAYSCALE 3)
+    uint16_t header_len;// sizeof(raw_header_t), skip this many bytes to get to the pixels
+    uint16_t width;
+    uint16_t height;
+    uint32_t stride;    // bytes per row
+    uint32_t seq;
+    uint32_t len;       // bytes of pixel data that follow
+    uint32_t ts_sec;    // wall clock capture time, same as X-Timestamp on /stream
+    uint32_t ts_usec;
+} raw_header_t;
+
+static_assert(sizeof(raw_header_t) == 32, "raw_header_t layout is part of the /raw protocol");
+
+#endif // FRAME_H
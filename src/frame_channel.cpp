@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <chrono>
+#include "frame_channel.h"
+
+static int64_t to_us(const struct timeval &tv) {
+    return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+FrameChannel::FrameChannel(int depth, size_t max_bytes)
+    : depth(depth < 1 ? 1 : depth > FRAME_CHANNEL_MAX_DEPTH ? FRAME_CHANNEL_MAX_DEPTH : depth),
+      max_bytes(max_bytes) {
+}
+
+void FrameChannel::publish(frame_t *frame) {
+    frame_t *evicted[FRAME_CHANNEL_MAX_DEPTH];
+    int evicted_count = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        // make room, but never drop below the frame being published
+        while (count > 0 && (count >= depth || (max_bytes && bytes + frame->len > max_bytes))) {
+            frame_t *oldest = ring[head];
+            head = (head + 1) % FRAME_CHANNEL_MAX_DEPTH;
+            count--;
+            bytes -= oldest->len;
+            evicted[evicted_count++] = oldest;
+        }
+        ring[(head + count) % FRAME_CHANNEL_MAX_DEPTH] = frame;
+        count++;
+        bytes += frame->len;
+        last_seq = frame->seq;
+    }
+    ready.notify_all();
+
+    // drop the references the channel held, outside the lock since this may free memory
+    for (int i = 0; i < evicted_count; i++) {
+        frame_release(evicted[i]);
+    }
+}
+
+frame_t *FrameChannel::acquire_next(uint32_t after_seq, uint32_t timeout_ms) {
+    std::unique_lock<std::mutex> guard(lock);
+
+    bool ok = ready.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this, after_seq] {
+        return count && newest()->seq > after_seq;
+    });
+    if (!ok) {
+        return nullptr;
+    }
+    return frame_ref(newest());
+}
+
+frame_t *FrameChannel::acquire_after(uint32_t after_seq, uint32_t timeout_ms) {
+    std::unique_lock<std::mutex> guard(lock);
+
+    bool ok = ready.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this, after_seq] {
+        return count && newest()->seq > after_seq;
+    });
+    if (!ok) {
+        return nullptr;
+    }
+    for (int i = 0; i < count; i++) {
+        if (at_index(i)->seq > after_seq) {
+            return frame_ref(at_index(i));
+        }
+    }
+    return nullptr;
+}
+
+frame_t *FrameChannel::acquire_nearest(const struct timeval &at, uint32_t timeout_ms, int64_t *delta_us) {
+    int64_t target = to_us(at);
+    std::unique_lock<std::mutex> guard(lock);
+
+    // until a frame at or past the target exists, a closer one may still be coming,
+    // so a target still ahead after the wait gets nothing rather than a stale frame
+    bool reached = ready.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this, target] {
+        return count && to_us(newest()->wall) >= target;
+    });
+    if (!reached) {
+        return nullptr;
+    }
+
+    frame_t *best = nullptr;
+    int64_t best_delta = 0;
+    for (int i = 0; i < count; i++) {
+        int64_t delta = to_us(at_index(i)->wall) - target;
+        if (!best || llabs(delta) < llabs(best_delta)) {
+            best = at_index(i);
+            best_delta = delta;
+        }
+    }
+    *delta_us = best_delta;
+    return frame_ref(best);
+}
+
+void FrameChannel::retire() {
+    frame_t *retired[FRAME_CHANNEL_MAX_DEPTH];
+    int retired_count;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        retired_count = count;
+        for (int i = 0; i < count; i++) {
+            retired[i] = at_index(i);
+        }
+        count = 0;
+        bytes = 0;
+    }
+    for (int i = 0; i < retired_count; i++) {
+        frame_release(retired[i]);
+    }
+}
+
+uint32_t FrameChannel::latest_seq() {
+    std::lock_guard<std::mutex> guard(lock);
+    return last_seq;
+}
+
+uint32_t FrameChannel::oldest_seq() {
+    std::lock_guard<std::mutex> guard(lock);
+    return count ? ring[head]->seq : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef FRAME_CHANNEL_H
+#define FRAME_CHANNEL_H
+
+#include <mutex>
+#include <condition_variable>
+#include "frame.h"
+
+// Upper bound for the history depth of any channel
+#define FRAME_CHANNEL_MAX_DEPTH 16
+
+// Hands frames from one producer to any number of waiting consumers.
+// The channel keeps a reference to the last few published frames (at least the latest one),
+// bounded by a count and by the bytes they take up, oldest go first.
+class FrameChannel {
+  public:
+    // max_bytes 0 means only the depth limits the history
+    FrameChannel(int depth = 1, size_t max_bytes = 0);
+
+    // Takes over the caller's reference
+    void publish(frame_t *frame);
+
+    // Wait up to timeout_ms for a frame newer than after_seq, returns the latest one with a reference held
+    frame_t *acquire_next(uint32_t after_seq, uint32_t timeout_ms);
+
+    // Same, but returns the oldest frame in the history newer than after_seq,
+    // so a client that keeps up never misses a frame
+    frame_t *acquire_after(uint32_t after_seq, uint32_t timeout_ms);
+
+    // The frame whose wall clock time is closest to at. Waits up to timeout_ms while
+    // at is still ahead of the latest frame, nullptr if it still is after that.
+    // delta_us is frame time minus at.
+    frame_t *acquire_nearest(const struct timeval &at, uint32_t timeout_ms, int64_t *delta_us);
+
+    // Drop every reference the channel holds. Used for zero-copy frames, so the
+    // channel does not keep a driver buffer out of circulation.
+    void retire();
+
+    uint32_t latest_seq();
+    // Oldest sequence still in the history, 0 if empty
+    uint32_t oldest_seq();
+
+  private:
+    frame_t *newest() { return count ? ring[(head + count - 1) % FRAME_CHANNEL_MAX_DEPTH] : nullptr; }
+    frame_t *at_index(int i) { return ring[(head + i) % FRAME_CHANNEL_MAX_DEPTH]; }
+
+    std::mutex lock;
+    std::condition_variable ready;
+    frame_t *ring[FRAME_CHANNEL_MAX_DEPTH] = {};
+    int head = 0;
+    int count = 0;
+    int depth;
+    size_t bytes = 0;
+    size_t max_bytes;
+    uint32_t last_seq = 0;
+};
+
+#endif // FRAME_CHANNEL_H
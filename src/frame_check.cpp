@@ -0,0 +1,142 @@
+#include <mutex>
+#include <esp_timer.h>
+#include "frame_check.h"
+
+// A burst of bad frames would block the capture task on the UART, log at most this often.
+// The counters in /metrics see every frame.
+#define FRAME_CHECK_LOG_INTERVAL_US 1000000LL
+
+volatile frame_check_mode_t FrameCheck::check_mode = FRAME_CHECK_DROP;
+
+typedef struct {
+    char clock[48];                       // e.g. "xclk=20;pll=bypass:0,mul:25,..."
+    uint32_t frames;
+    uint32_t bad[JPEG_CHECK_CAUSES];      // indexed by jpeg_check_t, [0] unused
+} clock_bucket_t;
+
+static std::mutex check_lock;
+static uint32_t checked = 0;
+static uint32_t bad_total[JPEG_CHECK_CAUSES];
+static uint32_t trimmed = 0;             // good frames with padding after EOI
+static clock_bucket_t buckets[FRAME_CHECK_CLOCK_BUCKETS];
+static int bucket_count = 0;
+static int current_bucket = -1;
+static int oldest_bucket = 0;
+static int current_xclk = 20;
+static char current_pll[32] = "default";
+static int64_t last_log_us = 0;
+static uint32_t unlogged = 0;            // bad frames since the last log line
+
+// find or create the bucket for the current clock settings, called with check_lock held
+static void select_bucket() {
+    char clock[48];
+    snprintf(clock, sizeof(clock), "xclk=%d;pll=%s", current_xclk, current_pll);
+
+    for (int i = 0; i < bucket_count; i++) {
+        if (!strcmp(buckets[i].clock, clock)) {
+            current_bucket = i;
+            return;
+        }
+    }
+
+    int slot;
+    if (bucket_count < FRAME_CHECK_CLOCK_BUCKETS) {
+        slot = bucket_count++;
+    } else {
+        slot = oldest_bucket;
+        oldest_bucket = (oldest_bucket + 1) % FRAME_CHECK_CLOCK_BUCKETS;
+    }
+    memset(&buckets[slot], 0, sizeof(buckets[slot]));
+    strcpy(buckets[slot].clock, clock);
+    current_bucket = slot;
+}
+
+//public
+
+bool FrameCheck::stage(frame_t *frame) {
+    if (check_mode == FRAME_CHECK_OFF || frame->format != PIXFORMAT_JPEG) {
+        return true;
+    }
+
+    // a JPEG can never be larger than the raw RGB565 frame it was made from
+    size_t max_len = (size_t)frame->width * frame->height * 2;
+    size_t data_len = frame->len;
+    jpeg_check_t result = jpeg_check(frame->buf, frame->len, max_len, &data_len);
+
+    {
+        std::lock_guard<std::mutex> guard(check_lock);
+        if (current_bucket < 0) {
+            select_bucket();
+        }
+        checked++;
+        buckets[current_bucket].frames++;
+        if (result != JPEG_CHECK_OK) {
+            bad_total[result]++;
+            buckets[current_bucket].bad[result]++;
+        } else if (data_len < frame->len) {
+            trimmed++;
+        }
+    }
+
+    if (result == JPEG_CHECK_OK) {
+        // drop any padding after EOI so clients get exactly the JPEG
+        frame->len = data_len;
+        return true;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (now - last_log_us >= FRAME_CHECK_LOG_INTERVAL_US) {
+        Serial.printf("Frame %u failed integrity check: %s (len %u), %u more since the last report\n",
+            frame->seq, jpeg_check_name(result), (unsigned)frame->len, unlogged);
+        last_log_us = now;
+        unlogged = 0;
+    } else {
+        unlogged++;
+    }
+    return check_mode != FRAME_CHECK_DROP;
+}
+
+void FrameCheck::set_xclk(int mhz) {
+    std::lock_guard<std::mutex> guard(check_lock);
+    current_xclk = mhz;
+    select_bucket();
+}
+
+void FrameCheck::set_pll(const char *description) {
+    std::lock_guard<std::mutex> guard(check_lock);
+    snprintf(current_pll, sizeof(current_pll), "%s", description);
+    select_bucket();
+}
+
+int FrameCheck::write_metrics(char *out, size_t len) {
+    std::lock_guard<std::mutex> guard(check_lock);
+
+    static const char *mode_names[] = { "off", "count", "drop" };
+
+    size_t n = 0;
+    #define CHECK_REMAINING() (n < len ? len - n : 0)
+    #define CHECK_OUT() (out + (n < len ? n : len))
+
+    n += snprintf(CHECK_OUT(), CHECK_REMAINING(), "\"integrity\":{\"mode\":\"%s\",\"checked\":%u,\"trimmed\":%u",
+        mode_names[check_mode], checked, trimmed);
+    for (int c = 1; c < JPEG_CHECK_CAUSES; c++) {
+        n += snprintf(CHECK_OUT(), CHECK_REMAINING(), ",\"%s\":%u", jpeg_check_name((jpeg_check_t)c), bad_total[c]);
+    }
+
+    n += snprintf(CHECK_OUT(), CHECK_REMAINING(), ",\"clocks\":[");
+    for (int i = 0; i < bucket_count; i++) {
+        n += snprintf(CHECK_OUT(), CHECK_REMAINING(), "%s{\"clock\":\"%s\",\"frames\":%u",
+            i ? "," : "", buckets[i].clock, buckets[i].frames);
+        for (int c = 1; c < JPEG_CHECK_CAUSES; c++) {
+            n += snprintf(CHECK_OUT(), CHECK_REMAINING(), ",\"%s\":%u",
+                jpeg_check_name((jpeg_check_t)c), buckets[i].bad[c]);
+        }
+        n += snprintf(CHECK_OUT(), CHECK_REMAINING(), "}");
+    }
+    n += snprintf(CHECK_OUT(), CHECK_REMAINING(), "]}");
+
+    #undef CHECK_REMAINING
+    #undef CHECK_OUT
+
+    return n < len ? (int)n : (int)(len ? len - 1 : 0);
+}
@@ -0,0 +1,39 @@
+#ifndef FRAME_CHECK_H
+#define FRAME_CHECK_H
+
+#include <Arduino.h>
+#include "frame.h"
+#include "jpeg_check.h"
+
+// Clock settings the counters are bucketed by, oldest bucket is reused when full
+#define FRAME_CHECK_CLOCK_BUCKETS 8
+
+typedef enum {
+    FRAME_CHECK_OFF,    // publish everything unchecked
+    FRAME_CHECK_COUNT,  // check and count, but still publish bad frames
+    FRAME_CHECK_DROP    // check, count and drop bad frames; the capture task moves on to the next frame
+} frame_check_mode_t;
+
+// Capture stage that verifies JPEG markers and length before a frame is published.
+// Bad frames are counted per cause and per clock setting (/xclk and /spll),
+// so corruption can be lined up with the clock that caused it.
+class FrameCheck {
+  public:
+    // Registered with CaptureTask::add_stage, ahead of any stage that decodes
+    static bool stage(frame_t *frame);
+
+    static void set_mode(frame_check_mode_t mode) { check_mode = mode; }
+    static frame_check_mode_t get_mode() { return check_mode; }
+
+    // Called by the /xclk and /spll handlers after a successful change
+    static void set_xclk(int mhz);
+    static void set_pll(const char *description);
+
+    // Write the "integrity" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+
+  private:
+    static volatile frame_check_mode_t check_mode;
+};
+
+#endif // FRAME_CHECK_H
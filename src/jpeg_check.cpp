@@ -0,0 +1,85 @@
+#include <string.h>
+#include "jpeg_check.h"
+
+const char *jpeg_check_name(jpeg_check_t result) {
+    switch (result) {
+        case JPEG_CHECK_OK:        return "ok";
+        case JPEG_CHECK_TOO_SHORT: return "too_short";
+        case JPEG_CHECK_TOO_LONG:  return "too_long";
+        case JPEG_CHECK_NO_SOI:    return "no_soi";
+        case JPEG_CHECK_NO_EOI:    return "no_eoi";
+        default:                   return "unknown";
+    }
+}
+
+// true if any byte of w is 0xFF: invert, then the classic "has a zero byte" test
+static inline bool word_has_ff(uint32_t w) {
+    w = ~w;
+    return ((w - 0x01010101u) & ~w & 0x80808080u) != 0;
+}
+
+long jpeg_find_eoi(const uint8_t *buf, size_t len) {
+    if (len < 2) {
+        return -1;
+    }
+
+    // walk backwards over aligned 32 bit words and only look at the bytes of a
+    // word that holds an FF somewhere, most of the padding and entropy data is skipped
+    size_t end = len - 1; // last index where D9 may sit
+    size_t i = end + 1;
+
+    // unaligned tail one byte at a time
+    while (i > 0 && ((uintptr_t)(buf + i) & 3)) {
+        i--;
+        if (i >= 1 && buf[i] == 0xD9 && buf[i - 1] == 0xFF) {
+            return (long)(i - 1);
+        }
+    }
+
+    while (i >= 4) {
+        uint32_t w;
+        memcpy(&w, buf + i - 4, 4);
+        if (word_has_ff(w)) {
+            // FF can sit in the last byte of this word with D9 in the next one,
+            // or anywhere inside the word
+            for (size_t j = i; j > i - 4; j--) {
+                size_t k = j - 1;
+                if (k + 1 <= end && buf[k] == 0xFF && buf[k + 1] == 0xD9) {
+                    return (long)k;
+                }
+            }
+        }
+        i -= 4;
+    }
+
+    while (i > 0) {
+        i--;
+        if (i + 1 <= end && buf[i] == 0xFF && buf[i + 1] == 0xD9) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+jpeg_check_t jpeg_check(const uint8_t *buf, size_t len, size_t max_len, size_t *data_len) {
+    if (len < JPEG_MIN_LEN) {
+        return JPEG_CHECK_TOO_SHORT;
+    }
+    if (max_len && len > max_len) {
+        return JPEG_CHECK_TOO_LONG;
+    }
+    if (buf[0] != 0xFF || buf[1] != 0xD8 || buf[2] != 0xFF) {
+        return JPEG_CHECK_NO_SOI;
+    }
+
+    size_t window = len < JPEG_EOI_WINDOW ? len : JPEG_EOI_WINDOW;
+    long eoi = jpeg_find_eoi(buf + len - window, window);
+    if (eoi < 0) {
+        return JPEG_CHECK_NO_EOI;
+    }
+
+    if (data_len) {
+        *data_len = len - window + eoi + 2;
+    }
+    return JPEG_CHECK_OK;
+}
@@ -0,0 +1,34 @@
+#ifndef JPEG_CHECK_H
+#define JPEG_CHECK_H
+
+// Cheap structural checks on a JPEG frame before it is published.
+// Plain C with no Arduino dependency so it can be tested on the host.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Anything shorter than this cannot even hold the headers the sensors emit
+#define JPEG_MIN_LEN 256
+// How far back from the end of the buffer to look for the EOI marker,
+// the driver may leave some padding after it
+#define JPEG_EOI_WINDOW 2048
+
+typedef enum {
+    JPEG_CHECK_OK = 0,
+    JPEG_CHECK_TOO_SHORT,  // below JPEG_MIN_LEN
+    JPEG_CHECK_TOO_LONG,   // larger than an uncompressed frame of the same size
+    JPEG_CHECK_NO_SOI,     // does not start with FF D8 FF
+    JPEG_CHECK_NO_EOI,     // no FF D9 near the end, i.e. truncated
+    JPEG_CHECK_CAUSES
+} jpeg_check_t;
+
+const char *jpeg_check_name(jpeg_check_t result);
+
+// Verify markers and length. max_len of 0 skips the upper bound.
+// On success *data_len is the length up to and including the EOI marker.
+jpeg_check_t jpeg_check(const uint8_t *buf, size_t len, size_t max_len, size_t *data_len);
+
+// Offset of the last FF D9 in buf[0, len), or -1. Scans a word at a time.
+long jpeg_find_eoi(const uint8_t *buf, size_t len);
+
+#endif // JPEG_CHECK_H
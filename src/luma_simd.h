@@ -0,0 +1,29 @@
+#ifndef LUMA_SIMD_H
+#define LUMA_SIMD_H
+
+// Row converters for luma_stats_compute that use the ESP32-S3 vector unit (PIE).
+// Everywhere else, the host tests included, LUMA_SIMD is 0 and luma_stats.cpp
+// keeps its table driven scalar path.
+
+#include <stdint.h>
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+#define LUMA_SIMD 1
+#else
+#define LUMA_SIMD 0
+#endif
+
+// Widest row the converter takes, the 1/8 scale decode of the largest frame is 320
+#define LUMA_SIMD_MAX_WIDTH 320
+
+#if LUMA_SIMD
+// Luma of a row of big-endian RGB565 pixels, 8 at a time. Returns the converted row,
+// valid until the next call, or NULL when width is over LUMA_SIMD_MAX_WIDTH.
+// Not reentrant, only the capture task computes stats.
+const uint16_t *luma_simd_rgb565_be(const uint8_t *row, int width);
+#endif
+
+#endif // LUMA_SIMD_H
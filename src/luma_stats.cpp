@@ -0,0 +1,135 @@
+#include <string.h>
+#include "luma_stats.h"
+#include "luma_simd.h"
+
+// RGB565 luma is linear in R, G and B, and G is split across the two bytes,
+// so Y * 256 = hi_table[high byte] + lo_table[low byte]. Two 256 entry tables
+// replace the per pixel multiplies (BT.601 weights, rounding folded into hi_table).
+static uint16_t hi_table[256];
+static uint16_t lo_table[256];
+static bool tables_ready = false;
+
+static void build_tables() {
+    for (int b = 0; b < 256; b++) {
+        float r8 = (b >> 3) * 255.0f / 31.0f;
+        float g_hi = (b & 0x07) * 8 * 255.0f / 63.0f;
+        hi_table[b] = (uint16_t)(256.0f * (0.299f * r8 + 0.587f * g_hi) + 128.0f);
+
+        float g_lo = (b >> 5) * 255.0f / 63.0f;
+        float b8 = (b & 0x1F) * 255.0f / 31.0f;
+        lo_table[b] = (uint16_t)(256.0f * (0.587f * g_lo + 0.114f * b8));
+    }
+    tables_ready = true;
+}
+
+uint8_t luma_rgb565_be(uint8_t high, uint8_t low) {
+    if (!tables_ready) {
+        build_tables();
+    }
+    return (uint8_t)((hi_table[high] + lo_table[low]) >> 8);
+}
+
+static inline uint8_t luma_at(const uint8_t *row, int x, luma_format_t format) {
+    switch (format) {
+        case LUMA_FMT_YUYV:
+            return row[2 * x];
+        case LUMA_FMT_RGB565_BE:
+            return (uint8_t)((hi_table[row[2 * x]] + lo_table[row[2 * x + 1]]) >> 8);
+        default:
+            return row[x];
+    }
+}
+
+void luma_stats_compute(const uint8_t *pixels, int width, int height, int stride,
+                        luma_format_t format, int step, luma_stats_t *out) {
+    uint32_t hist[256];
+    uint32_t zone_sum[LUMA_ZONES_Y][LUMA_ZONES_X];
+    uint32_t zone_count[LUMA_ZONES_Y][LUMA_ZONES_X];
+
+    memset(hist, 0, sizeof(hist));
+    memset(zone_sum, 0, sizeof(zone_sum));
+    memset(zone_count, 0, sizeof(zone_count));
+
+    uint32_t seq = out->seq;
+    memset(out, 0, sizeof(*out));
+    out->seq = seq;
+    out->width = width;
+    out->height = height;
+
+    if (format == LUMA_FMT_RGB565_BE && !tables_ready) {
+        build_tables();
+    }
+    if (step < 1) {
+        step = 1;
+    }
+
+    for (int y = 0; y < height; y += step) {
+        const uint8_t *row = pixels + (size_t)y * stride;
+        int zy = y * LUMA_ZONES_Y / height;
+
+        // on the S3 the vector unit converts a full RGB565 row up front
+        const uint16_t *converted = NULL;
+#if LUMA_SIMD
+        if (format == LUMA_FMT_RGB565_BE && step == 1) {
+            converted = luma_simd_rgb565_be(row, width);
+        }
+#endif
+
+        // walk the row one zone at a time so the inner loop has no divisions
+        for (int zx = 0; zx < LUMA_ZONES_X; zx++) {
+            int x0 = (zx * width + LUMA_ZONES_X - 1) / LUMA_ZONES_X;
+            int x1 = ((zx + 1) * width + LUMA_ZONES_X - 1) / LUMA_ZONES_X;
+            // keep sampling on the global step grid
+            x0 = (x0 + step - 1) / step * step;
+
+            uint32_t sum = 0;
+            uint32_t count = 0;
+            if (converted) {
+                for (int x = x0; x < x1; x++) {
+                    uint8_t l = (uint8_t)converted[x];
+                    hist[l]++;
+                    sum += l;
+                    count++;
+                }
+            } else {
+                for (int x = x0; x < x1; x += step) {
+                    uint8_t l = luma_at(row, x, format);
+                    hist[l]++;
+                    sum += l;
+                    count++;
+                }
+            }
+            zone_sum[zy][zx] += sum;
+            zone_count[zy][zx] += count;
+        }
+    }
+
+    uint64_t total = 0;
+    uint32_t pixels_seen = 0;
+    uint32_t low = 0;
+    uint32_t high = 0;
+    for (int l = 0; l < 256; l++) {
+        out->hist[l * LUMA_BINS / 256] += hist[l];
+        total += (uint64_t)hist[l] * l;
+        pixels_seen += hist[l];
+        if (l <= LUMA_CLIP_LOW) {
+            low += hist[l];
+        }
+        if (l >= LUMA_CLIP_HIGH) {
+            high += hist[l];
+        }
+    }
+
+    out->pixels = pixels_seen;
+    if (pixels_seen) {
+        out->mean_x100 = (uint16_t)(total * 100 / pixels_seen);
+        out->clip_low_permille = (uint16_t)((uint64_t)low * 1000 / pixels_seen);
+        out->clip_high_permille = (uint16_t)((uint64_t)high * 1000 / pixels_seen);
+    }
+
+    for (int zy = 0; zy < LUMA_ZONES_Y; zy++) {
+        for (int zx = 0; zx < LUMA_ZONES_X; zx++) {
+            out->zones[zy][zx] = zone_count[zy][zx] ? zone_sum[zy][zx] / zone_count[zy][zx] : 0;
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef LUMA_STATS_H
+#define LUMA_STATS_H
+
+// Luma histogram and exposure statistics over an 8 bit image.
+// Plain C with no Arduino dependency so it can be tested on the host. On the
+// ESP32-S3, RGB565 rows go through the vector unit first, see luma_simd.h.
+
+#include <stdint.h>
+
+#define LUMA_BINS 64           // histogram bins, 4 luma levels each
+#define LUMA_ZONES_X 4         // zone grid for per-zone brightness
+#define LUMA_ZONES_Y 4
+#define LUMA_CLIP_LOW 4        // luma at or below this counts as crushed black
+#define LUMA_CLIP_HIGH 251     // luma at or above this counts as blown out
+
+typedef enum {
+    LUMA_FMT_GRAY,      // one byte per pixel
+    LUMA_FMT_YUYV,      // YUV422, Y U Y V byte order
+    LUMA_FMT_RGB565_BE  // RGB565 high byte first, as the camera and jpg2rgb565 write it
+} luma_format_t;
+
+// Integer only and naturally aligned, so it goes on the wire as is (little-endian)
+typedef struct {
+    uint32_t seq;                 // frame sequence number the stats were computed from
+    uint32_t pixels;              // pixels sampled
+    uint32_t compute_us;          // time to decode and sample the frame
+    uint16_t width;               // size of the sampled image
+    uint16_t height;
+    uint16_t mean_x100;           // mean luma * 100
+    uint16_t clip_low_permille;   // share of pixels <= LUMA_CLIP_LOW, in 1/1000
+    uint16_t clip_high_permille;  // share of pixels >= LUMA_CLIP_HIGH, in 1/1000
+    uint16_t reserved;
+    uint8_t zones[LUMA_ZONES_Y][LUMA_ZONES_X]; // mean luma per zone, row major
+    uint32_t hist[LUMA_BINS];
+} luma_stats_t;
+
+// Sample every step-th pixel of every step-th row. stride is the row length in bytes.
+void luma_stats_compute(const uint8_t *pixels, int width, int height, int stride,
+                        luma_format_t format, int step, luma_stats_t *out);
+
+// Luma of one big-endian RGB565 pixel from the scalar tables, the reference for the vector path
+uint8_t luma_rgb565_be(uint8_t high, uint8_t low);
+
+#endif // LUMA_STATS_H
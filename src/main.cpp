@@ -1,6 +1,14 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include "camera_hal.h"
+#include "memory_manager.h"
+#include "capture_task.h"
+#include "preview_encoder.h"
+#include "exposure_stats.h"
+#include "frame_check.h"
+#include "wall_clock.h"
+#include "task_monitor.h"
+#include "timelapse.h"
 #include "web_server.h"
 #include "wifi_config.h"
 
@@ -30,18 +38,63 @@ void setup() {
   Serial.println("WiFi connected");
   Serial.print(WiFi.localIP());
   Serial.println("' to connect");
+
+  // frame timestamps follow the SNTP clock, so frames from several cameras can be matched up
+  WallClock::init();
+
+  // before the tasks it should measure are created
+  if (TaskMonitor::init() != ESP_OK) {
+    Serial.println("Task monitor init failed, /metrics has no CPU load");
+  }
   
-  esp_err_t esp_err = CameraHal::init();
+  // reserve the frame arena and buffer pools before anything else can fragment PSRAM
+  esp_err_t esp_err = MemoryManager::init();
+  if (esp_err != ESP_OK) {
+    Serial.printf("MemoryManager init failed with error 0x%x", esp_err);
+    return;
+  }
+
+  esp_err = CameraHal::init();
   if (esp_err != ESP_OK) {
     Serial.printf("CameraHALInit failed with error 0x%x", esp_err);
     return;
   }
 
+  // stages run on the capture core in the order they are added,
+  // reject broken frames before anything tries to decode them
+  CaptureTask::add_stage(FrameCheck::stage);
+
+  if (ExposureStats::init() == ESP_OK) {
+    CaptureTask::add_stage(ExposureStats::stage);
+  } else {
+    Serial.println("No memory for exposure statistics, /histogram disabled");
+  }
+
+  if (CaptureTask::start() != ESP_OK) {
+    Serial.println("Capture task start failed");
+    return;
+  }
+
+  // only does work while the camera is in a raw format, then it keeps /stream and /snapshot fed
+  if (PreviewEncoder::start() != ESP_OK) {
+    Serial.println("Preview encoder start failed, /stream is unavailable in raw modes");
+  }
+
   if (WebServer::init() != ESP_OK) {
     Serial.println("Web server init failed");
     return;
   }
 
+#ifdef TIMELAPSE_INTERVAL_S
+  // battery units start straight into time-lapse, /timelapse can still change or stop it
+  timelapse_params_t timelapse = {};
+  timelapse.interval_s = TIMELAPSE_INTERVAL_S;
+  timelapse.warmup_frames = TIMELAPSE_WARMUP_FRAMES;
+  if (TimeLapse::start(timelapse) != ESP_OK) {
+    Serial.println("Time-lapse start failed");
+  }
+#endif
+
 }
 
 void loop() {
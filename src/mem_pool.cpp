@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mem_pool.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+void *mem_region_alloc(size_t len, mem_region_t region) {
+#ifdef ESP_PLATFORM
+    uint32_t caps = MALLOC_CAP_8BIT;
+    caps |= (region == MEM_REGION_PSRAM) ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL;
+    return heap_caps_malloc(len, caps);
+#else
+    (void)region;
+    return ::malloc(len);
+#endif
+}
+
+void mem_region_free(void *p) {
+#ifdef ESP_PLATFORM
+    heap_caps_free(p);
+#else
+    ::free(p);
+#endif
+}
+
+static inline size_t align_up(size_t len, size_t align) {
+    return (len + align - 1) & ~(align - 1);
+}
+
+// SlabPool
+
+SlabPool::~SlabPool() {
+    if (storage) {
+        mem_region_free(storage);
+    }
+    if (in_use) {
+        mem_region_free(in_use);
+    }
+}
+
+bool SlabPool::init(size_t size, size_t count, mem_region_t region) {
+    if (storage || count == 0) {
+        return false;
+    }
+
+    // every free block stores the pointer to the next free block in its first bytes
+    block_len = align_up(size < sizeof(void *) ? sizeof(void *) : size, sizeof(void *));
+    block_count = count;
+    storage = (uint8_t *)mem_region_alloc(block_len * block_count, region);
+    // the bitmap is tiny and checked on every free, keep it in internal RAM
+    size_t map_len = (block_count + 31) / 32 * sizeof(uint32_t);
+    in_use = (uint32_t *)mem_region_alloc(map_len, MEM_REGION_INTERNAL);
+    if (!storage || !in_use) {
+        mem_region_free(storage);
+        mem_region_free(in_use);
+        storage = nullptr;
+        in_use = nullptr;
+        return false;
+    }
+    memset(in_use, 0, map_len);
+
+    // thread all blocks onto the free list, first block at the front
+    free_list = nullptr;
+    for (size_t i = block_count; i > 0; i--) {
+        void *block = storage + (i - 1) * block_len;
+        *(void **)block = free_list;
+        free_list = block;
+    }
+    return true;
+}
+
+void *SlabPool::alloc() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (!free_list) {
+        fail_count++;
+        return nullptr;
+    }
+
+    void *block = free_list;
+    free_list = *(void **)block;
+    size_t index = ((uint8_t *)block - storage) / block_len;
+    in_use[index / 32] |= 1u << (index % 32);
+
+    alloc_count++;
+    used_blocks++;
+    if (used_blocks > peak_blocks) {
+        peak_blocks = used_blocks;
+    }
+    return block;
+}
+
+void SlabPool::free(void *p) {
+    if (!p || !owns(p)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    size_t index = ((uint8_t *)p - storage) / block_len;
+    uint32_t bit = 1u << (index % 32);
+    if (!(in_use[index / 32] & bit)) {
+        bad_free_count++;
+        return;
+    }
+    in_use[index / 32] &= ~bit;
+
+    *(void **)p = free_list;
+    free_list = p;
+    used_blocks--;
+}
+
+bool SlabPool::owns(const void *p) const {
+    const uint8_t *b = (const uint8_t *)p;
+    return storage && b >= storage && b < storage + block_len * block_count
+        && ((size_t)(b - storage) % block_len) == 0;
+}
+
+mem_stats_t SlabPool::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    mem_stats_t s = {};
+    s.capacity = block_len * block_count;
+    s.in_use = block_len * used_blocks;
+    s.high_water = block_len * peak_blocks;
+    s.largest_free = free_list ? block_len : 0;
+    s.allocs = alloc_count;
+    s.failures = fail_count;
+    s.bad_frees = bad_free_count;
+    return s;
+}
+
+// FrameArena
+
+FrameArena::~FrameArena() {
+    if (storage) {
+        mem_region_free(storage);
+    }
+}
+
+bool FrameArena::init(size_t size, mem_region_t region) {
+    if (storage) {
+        return false;
+    }
+
+    // keep the capacity a multiple of the alignment so that the gap left at the
+    // end of the buffer is always large enough to hold a padding header
+    capacity = size & ~(ALIGN - 1);
+    if (capacity < 2 * sizeof(BlockHeader)) {
+        return false;
+    }
+
+    storage = (uint8_t *)mem_region_alloc(capacity, region);
+    return storage != nullptr;
+}
+
+void *FrameArena::alloc(size_t len) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // zero length requests still get a payload byte so every block has a distinct address
+    size_t need = align_up(len ? len : 1, ALIGN) + sizeof(BlockHeader);
+    if (!storage || need > capacity) {
+        fail_count++;
+        return nullptr;
+    }
+
+    if (used == 0) {
+        // nothing live: start over at the beginning so the whole buffer is contiguous
+        head = tail = 0;
+    }
+
+    bool full = used > 0 && head == tail;
+    if (!full && head >= tail) {
+        // free space is [head, capacity) followed by [0, tail)
+        if (capacity - head < need) {
+            if (tail < need) {
+                fail_count++;
+                return nullptr;
+            }
+            // not enough room before the end: pad out the end and wrap around
+            BlockHeader *pad = (BlockHeader *)(storage + head);
+            pad->size = capacity - head;
+            pad->live = 0;
+            used += pad->size;
+            head = 0;
+        }
+    } else if (full || tail - head < need) {
+        // free space is the single run [head, tail)
+        fail_count++;
+        return nullptr;
+    }
+
+    BlockHeader *hdr = (BlockHeader *)(storage + head);
+    hdr->size = need;
+    hdr->live = 1;
+
+    head += need;
+    if (head == capacity) {
+        head = 0;
+    }
+    used += need;
+    live_bytes += need;
+    alloc_count++;
+    if (used > peak_used) {
+        peak_used = used;
+    }
+
+    return hdr + 1;
+}
+
+void FrameArena::free(void *p) {
+    if (!p || !owns(p)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    BlockHeader *hdr = (BlockHeader *)p - 1;
+    if (!is_live_block(hdr)) {
+        bad_free_count++;
+        return;
+    }
+    hdr->live = 0;
+    live_bytes -= hdr->size;
+    reclaim();
+}
+
+bool FrameArena::owns(const void *p) const {
+    const uint8_t *b = (const uint8_t *)p;
+    return storage && b >= storage + sizeof(BlockHeader) && b < storage + capacity;
+}
+
+// advance the tail over every released block, stopping at the oldest live one
+void FrameArena::reclaim() {
+    while (used > 0) {
+        BlockHeader *hdr = (BlockHeader *)(storage + tail);
+        if (hdr->live) {
+            break;
+        }
+        tail += hdr->size;
+        used -= hdr->size;
+        if (tail == capacity) {
+            tail = 0;
+        }
+    }
+    if (used == 0) {
+        head = tail = 0;
+    }
+}
+
+// whether hdr starts a block still held by a caller. Walks the blocks from the tail, so a
+// pointer into a payload or a block already reclaimed never has a header read out of frame
+// data. Only a few frames are ever in flight, the walk is short.
+bool FrameArena::is_live_block(const BlockHeader *hdr) const {
+    size_t offset = (const uint8_t *)hdr - storage;
+    if (offset % ALIGN) {
+        return false;
+    }
+
+    size_t pos = tail;
+    size_t walked = 0;
+    while (walked < used) {
+        const BlockHeader *block = (const BlockHeader *)(storage + pos);
+        if (pos == offset) {
+            return block->live;
+        }
+        walked += block->size;
+        pos += block->size;
+        if (pos == capacity) {
+            pos = 0;
+        }
+    }
+    return false;
+}
+
+size_t FrameArena::largest_free() const {
+    size_t run;
+    if (used == 0) {
+        run = capacity;
+    } else if (head == tail) {
+        run = 0;
+    } else if (head > tail) {
+        run = (capacity - head > tail) ? capacity - head : tail;
+    } else {
+        run = tail - head;
+    }
+    return run > sizeof(BlockHeader) ? run - sizeof(BlockHeader) : 0;
+}
+
+mem_stats_t FrameArena::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    mem_stats_t s = {};
+    s.capacity = capacity;
+    s.in_use = live_bytes;
+    s.high_water = peak_used;
+    s.largest_free = largest_free();
+    s.stranded = used - live_bytes;
+    s.allocs = alloc_count;
+    s.failures = fail_count;
+    s.bad_frees = bad_free_count;
+    return s;
+}
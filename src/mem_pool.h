@@ -0,0 +1,111 @@
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+// Fixed-size slab pools and a ring arena for frame-sized payloads.
+//
+// Nothing in here depends on Arduino or the camera driver, so the allocators
+// can be compiled and exercised on the host. On the device the backing storage
+// comes from heap_caps_malloc so it can be placed in PSRAM.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+// Where a pool or arena takes its backing storage from
+enum mem_region_t {
+    MEM_REGION_INTERNAL, // on-chip SRAM, fast but small
+    MEM_REGION_PSRAM     // external PSRAM, slow but large (8 MB on the Xiao Sense)
+};
+
+typedef struct {
+    size_t capacity;      // total bytes of backing storage
+    size_t in_use;        // bytes currently handed out (including headers / whole blocks)
+    size_t high_water;    // largest in_use ever seen
+    size_t largest_free;  // largest single allocation that would succeed right now
+    size_t stranded;      // arena only: released bytes stuck behind a live block
+    uint32_t allocs;      // successful allocations
+    uint32_t failures;    // allocations refused because the pool was exhausted
+    uint32_t bad_frees;   // frees of a block that was not handed out, e.g. freed twice, ignored
+} mem_stats_t;
+
+void *mem_region_alloc(size_t len, mem_region_t region);
+void mem_region_free(void *p);
+
+// Pool of equally sized blocks. Allocation and release are O(1) and never
+// fragment, which makes it the right home for descriptors and small buffers.
+class SlabPool {
+  public:
+    SlabPool() {}
+    ~SlabPool();
+
+    bool init(size_t block_size, size_t block_count, mem_region_t region);
+
+    // Returns nullptr straight away when the pool is empty - never blocks
+    void *alloc();
+    // Freeing a block that is not handed out is counted and otherwise ignored,
+    // so a double free can never put the same block on the free list twice
+    void free(void *p);
+
+    bool owns(const void *p) const;
+    size_t block_size() const { return block_len; }
+    mem_stats_t stats();
+
+  private:
+    uint8_t *storage = nullptr;
+    size_t block_len = 0;
+    size_t block_count = 0;
+    void *free_list = nullptr;
+    uint32_t *in_use = nullptr;   // one bit per block, set while handed out
+    size_t used_blocks = 0;
+    size_t peak_blocks = 0;
+    uint32_t alloc_count = 0;
+    uint32_t fail_count = 0;
+    uint32_t bad_free_count = 0;
+    std::mutex lock;
+};
+
+// Ring (bump) allocator for variable sized frame payloads. Allocations are
+// carved from the head of a single contiguous buffer and reclaimed from the
+// tail, so frames that are released roughly in capture order never leave
+// holes behind. A block released out of order is only reclaimed once every
+// block older than it has been released too; until then it is "stranded".
+class FrameArena {
+  public:
+    FrameArena() {}
+    ~FrameArena();
+
+    bool init(size_t capacity, mem_region_t region);
+
+    // Returns nullptr straight away when there is no contiguous room - never blocks
+    void *alloc(size_t len);
+    void free(void *p);
+
+    bool owns(const void *p) const;
+    mem_stats_t stats();
+
+  private:
+    struct BlockHeader {
+        uint32_t size; // block size including this header
+        uint32_t live; // 1 while the caller holds the block, 0 once released or padding
+    };
+
+    static const size_t ALIGN = 8;
+
+    void reclaim();
+    bool is_live_block(const BlockHeader *hdr) const;
+    size_t largest_free() const;
+
+    uint8_t *storage = nullptr;
+    size_t capacity = 0;
+    size_t head = 0;      // next allocation goes here
+    size_t tail = 0;      // oldest block not yet reclaimed
+    size_t used = 0;      // bytes between tail and head, including padding
+    size_t live_bytes = 0;
+    size_t peak_used = 0;
+    uint32_t alloc_count = 0;
+    uint32_t fail_count = 0;
+    uint32_t bad_free_count = 0;
+    std::mutex lock;
+};
+
+#endif // MEM_POOL_H
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <esp_heap_caps.h>
+#include "memory_manager.h"
+
+SlabPool MemoryManager::descriptor_pool;
+SlabPool MemoryManager::buffer_pool;
+FrameArena MemoryManager::frame_arena;
+
+//public
+
+esp_err_t MemoryManager::init() {
+    // Carve everything out once at boot, so later allocations can only fail
+    // because a pool is exhausted, never because the heap got fragmented
+    if (!descriptor_pool.init(MEM_DESCRIPTOR_SIZE, MEM_DESCRIPTOR_COUNT, MEM_REGION_INTERNAL)) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!buffer_pool.init(MEM_BUFFER_SIZE, MEM_BUFFER_COUNT, MEM_REGION_PSRAM)) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!frame_arena.init(MEM_FRAME_ARENA_SIZE, MEM_REGION_PSRAM)) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Fragmentation as a percentage: 0 when all free memory is one contiguous run
+static unsigned fragmentation(size_t free_bytes, size_t largest) {
+    if (free_bytes == 0) {
+        return 0;
+    }
+    return (unsigned)(100 - (largest * 100) / free_bytes);
+}
+
+static int print_stats(char *out, size_t len, const char *name, const mem_stats_t &s) {
+    return snprintf(out, len,
+        "\"%s\":{\"capacity\":%u,\"in_use\":%u,\"high_water\":%u,\"largest_free\":%u,"
+        "\"stranded\":%u,\"frag\":%u,\"allocs\":%u,\"failures\":%u,\"bad_frees\":%u}",
+        name, (unsigned)s.capacity, (unsigned)s.in_use, (unsigned)s.high_water, (unsigned)s.largest_free,
+        (unsigned)s.stranded, fragmentation(s.capacity - s.in_use, s.largest_free),
+        (unsigned)s.allocs, (unsigned)s.failures, (unsigned)s.bad_frees);
+}
+
+int MemoryManager::write_metrics(char *out, size_t len) {
+    size_t internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t internal_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    size_t psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    size_t psram_largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+
+    size_t n = 0;
+    // snprintf returns the length it wanted to write, so clamp before every step
+    #define MEM_REMAINING() (n < len ? len - n : 0)
+    #define MEM_OUT() (out + (n < len ? n : len))
+
+    n += snprintf(MEM_OUT(), MEM_REMAINING(),
+        "\"mem\":{\"heap\":{\"internal_free\":%u,\"internal_largest\":%u,\"internal_min\":%u,\"internal_frag\":%u,"
+        "\"psram_free\":%u,\"psram_largest\":%u,\"psram_min\":%u,\"psram_frag\":%u},",
+        (unsigned)internal_free, (unsigned)internal_largest,
+        (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL), fragmentation(internal_free, internal_largest),
+        (unsigned)psram_free, (unsigned)psram_largest,
+        (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM), fragmentation(psram_free, psram_largest));
+
+    n += print_stats(MEM_OUT(), MEM_REMAINING(), "descriptors", descriptor_pool.stats());
+    n += snprintf(MEM_OUT(), MEM_REMAINING(), ",");
+    n += print_stats(MEM_OUT(), MEM_REMAINING(), "buffers", buffer_pool.stats());
+    n += snprintf(MEM_OUT(), MEM_REMAINING(), ",");
+    n += print_stats(MEM_OUT(), MEM_REMAINING(), "frames", frame_arena.stats());
+    n += snprintf(MEM_OUT(), MEM_REMAINING(), "}");
+
+    #undef MEM_REMAINING
+    #undef MEM_OUT
+
+    return n < len ? (int)n : (int)(len ? len - 1 : 0);
+}
@@ -0,0 +1,47 @@
+#ifndef MEMORY_MANAGER_H
+#define MEMORY_MANAGER_H
+
+#include <esp_err.h>
+#include "mem_pool.h"
+
+// Pool sizes can be overridden from build_flags in platformio.ini
+
+// Small fixed size records (frame descriptors, request contexts)
+#ifndef MEM_DESCRIPTOR_SIZE
+#define MEM_DESCRIPTOR_SIZE 128
+#endif
+#ifndef MEM_DESCRIPTOR_COUNT
+#define MEM_DESCRIPTOR_COUNT 64
+#endif
+
+// Scratch buffers for HTTP query strings, headers and JSON responses
+#ifndef MEM_BUFFER_SIZE
+#define MEM_BUFFER_SIZE 8192
+#endif
+#ifndef MEM_BUFFER_COUNT
+#define MEM_BUFFER_COUNT 16
+#endif
+
+// PSRAM ring for frame copies that outlive esp_camera_fb_return
+#ifndef MEM_FRAME_ARENA_SIZE
+#define MEM_FRAME_ARENA_SIZE (3 * 1024 * 1024)
+#endif
+
+class MemoryManager {
+  public:
+    static esp_err_t init();
+
+    static SlabPool& descriptors() { return descriptor_pool; }
+    static SlabPool& buffers() { return buffer_pool; }
+    static FrameArena& frames() { return frame_arena; }
+
+    // Write the "mem" member of the /metrics JSON object, returns the number of characters written
+    static int write_metrics(char *out, size_t len);
+
+  private:
+    static SlabPool descriptor_pool;
+    static SlabPool buffer_pool;
+    static FrameArena frame_arena;
+};
+
+#endif // MEMORY_MANAGER_H
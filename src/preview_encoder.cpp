@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_timer.h>
+#include <img_converters.h>
+#include "preview_encoder.h"
+#include "capture_task.h"
+#include "mem_pool.h"
+#include "task_config.h"
+#include "task_monitor.h"
+
+TaskHandle_t PreviewEncoder::task = NULL;
+uint8_t *PreviewEncoder::encode_buf = nullptr;
+volatile uint32_t PreviewEncoder::interval_ms = PREVIEW_INTERVAL_MS;
+preview_stats_t PreviewEncoder::stats = {};
+
+// how long to wait for a raw frame before checking the interval again
+#define PREVIEW_WAIT_MS 1000
+
+//public
+
+esp_err_t PreviewEncoder::start() {
+    encode_buf = (uint8_t *)mem_region_alloc(PREVIEW_BUF_SIZE, MEM_REGION_PSRAM);
+    if (!encode_buf) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // one below the capture task, so encoding only ever uses the time capture leaves over
+    BaseType_t res = xTaskCreatePinnedToCore(run, "preview", CAPTURE_TASK_STACK, NULL,
+                                             CAPTURE_TASK_PRIORITY - 1, &task, CAPTURE_CORE);
+    TaskMonitor::watch(task);
+    return res == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+int PreviewEncoder::write_metrics(char *out, size_t len) {
+    preview_stats_t s = stats;
+    return snprintf(out, len,
+        "\"preview\":{\"interval_ms\":%u,\"quality\":%d,\"encoded\":%u,\"failed\":%u,"
+        "\"last_seq\":%u,\"last_us\":%u,\"last_len\":%u}",
+        (unsigned)interval_ms, PREVIEW_QUALITY, s.encoded, s.failed, s.last_seq, s.last_us, s.last_len);
+}
+
+//private
+
+void PreviewEncoder::run(void *arg) {
+    uint32_t last_seq = 0;
+
+    while (true) {
+        if (interval_ms == 0) {
+            vTaskDelay(pdMS_TO_TICKS(PREVIEW_WAIT_MS));
+            continue;
+        }
+
+        frame_t *raw = CaptureTask::acquire_next_raw(last_seq, PREVIEW_WAIT_MS);
+        if (!raw) {
+            continue;
+        }
+        last_seq = raw->seq;
+
+        int64_t start = esp_timer_get_time();
+        size_t len = 0;
+        bool ok = fmt2jpg_cb(raw->buf, raw->len, raw->width, raw->height, raw->format,
+                             PREVIEW_QUALITY, write_out, &len);
+        uint32_t took = (uint32_t)(esp_timer_get_time() - start);
+
+        // the preview frame takes over seq and timestamp, only the payload differs
+        frame_t *jpeg = nullptr;
+        if (ok && len <= PREVIEW_BUF_SIZE) {
+            frame_t meta = *raw;
+            meta.format = PIXFORMAT_JPEG;
+            jpeg = frame_copy(encode_buf, len, &meta);
+        }
+        CaptureTask::release(raw);
+
+        if (jpeg) {
+            CaptureTask::publish_jpeg(jpeg);
+            stats.encoded++;
+            stats.last_seq = last_seq;
+            stats.last_us = took;
+            stats.last_len = len;
+        } else {
+            stats.failed++;
+        }
+
+        int64_t wait_ms = (int64_t)interval_ms - (esp_timer_get_time() - start) / 1000;
+        if (wait_ms > 0) {
+            vTaskDelay(pdMS_TO_TICKS(wait_ms));
+        }
+    }
+}
+
+// Encoder output callback, collects the JPEG in encode_buf
+size_t PreviewEncoder::write_out(void *arg, size_t index, const void *data, size_t len) {
+    size_t *total = (size_t *)arg;
+    if (index + len > PREVIEW_BUF_SIZE) {
+        // returning less than len makes the encoder give up
+        *total = PREVIEW_BUF_SIZE + 1;
+        return 0;
+    }
+    memcpy(encode_buf + index, data, len);
+    *total = index + len;
+    return len;
+}
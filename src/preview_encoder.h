@@ -0,0 +1,58 @@
+#ifndef PREVIEW_ENCODER_H
+#define PREVIEW_ENCODER_H
+
+#include <Arduino.h>
+#include <esp_err.h>
+#include "frame.h"
+
+// Time between two preview frames. The software encoder needs roughly 100 ms for a
+// VGA frame on one core, so it cannot keep up with the sensor and should not try.
+#ifndef PREVIEW_INTERVAL_MS
+#define PREVIEW_INTERVAL_MS 250
+#endif
+
+#ifndef PREVIEW_QUALITY
+#define PREVIEW_QUALITY 30
+#endif
+
+// Largest preview JPEG, anything bigger is dropped
+#ifndef PREVIEW_BUF_SIZE
+#define PREVIEW_BUF_SIZE (256 * 1024)
+#endif
+
+typedef struct {
+    uint32_t encoded;
+    uint32_t failed;    // encoder error or the JPEG did not fit PREVIEW_BUF_SIZE
+    uint32_t last_seq;
+    uint32_t last_us;   // time the last encode took
+    uint32_t last_len;
+} preview_stats_t;
+
+// While the camera delivers raw frames, a low priority task on the capture core
+// encodes some of them to JPEG and publishes those on the regular frame channel,
+// so /stream, /snapshot and /sweep keep working from the same capture as /raw.
+// The preview keeps the sequence number and timestamp of the raw frame it came from.
+class PreviewEncoder {
+  public:
+    static esp_err_t start();
+
+    // 0 stops encoding
+    static void set_interval_ms(uint32_t ms) { interval_ms = ms; }
+    static uint32_t get_interval_ms() { return interval_ms; }
+
+    static preview_stats_t get_stats() { return stats; }
+
+    // Write the "preview" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+
+  private:
+    static void run(void *arg);
+    static size_t write_out(void *arg, size_t index, const void *data, size_t len);
+
+    static TaskHandle_t task;
+    static uint8_t *encode_buf;
+    static volatile uint32_t interval_ms;
+    static preview_stats_t stats;
+};
+
+#endif // PREVIEW_ENCODER_H
@@ -0,0 +1,82 @@
+#include <mutex>
+#include <Arduino.h>
+#include "reg_dump.h"
+
+RegisterMap RegDump::reg_map;
+
+static std::mutex dump_lock;
+
+// OV5640 / OV3660: system and PLL, AEC, timing, AEC control, format, JPEG,
+// ISP control, AWB, CIP, colour matrix, gamma, SDE and lens correction blocks
+static const reg_range_t ov5640_ranges[] = {
+    { 0x3000, 0x40 }, { 0x3100, 0x09 }, { 0x3500, 0x0E }, { 0x3800, 0x22 },
+    { 0x3A00, 0x26 }, { 0x4300, 0x02 }, { 0x4400, 0x08 }, { 0x4700, 0x0C },
+    { 0x5000, 0x08 }, { 0x5180, 0x51 }, { 0x5300, 0x11 }, { 0x5380, 0x0C },
+    { 0x5480, 0x11 }, { 0x5580, 0x0B }, { 0x5800, 0x3E },
+};
+
+// OV2640: esp32-camera addresses the DSP bank as 0x0xx and the sensor bank as 0x1xx
+static const reg_range_t ov2640_ranges[] = {
+    { 0x000, 0x100 }, { 0x100, 0x100 },
+};
+
+// everything else has 8 bit register addresses
+static const reg_range_t default_ranges[] = {
+    { 0x00, 0x100 },
+};
+
+static int read_reg(void *ctx, uint16_t reg) {
+    sensor_t *sensor = (sensor_t *)ctx;
+    return sensor->get_reg(sensor, reg, 0xFF);
+}
+
+//public
+
+esp_err_t RegDump::configure(sensor_t *sensor, const char *ranges_text) {
+    std::lock_guard<std::mutex> guard(dump_lock);
+    return set_ranges(sensor, ranges_text);
+}
+
+size_t RegDump::snapshot(sensor_t *sensor, bool delta, uint32_t since, uint8_t *out, size_t len) {
+    // held for the check too, /regdump?ranges= configures from the server task
+    std::lock_guard<std::mutex> guard(dump_lock);
+
+    // first use, or the sensor changed under us: start over with its defaults
+    if (reg_map.get_range_count() == 0 || reg_map.get_pid() != sensor->id.PID) {
+        if (set_ranges(sensor, NULL) != ESP_OK) {
+            return 0;
+        }
+    }
+
+    int errors = reg_map.refresh(read_reg, sensor);
+    if (errors) {
+        Serial.printf("Register dump: %d registers could not be read\n", errors);
+    }
+    return delta ? reg_map.write_delta(since, out, len) : reg_map.write_full(out, len);
+}
+
+//private
+
+esp_err_t RegDump::set_ranges(sensor_t *sensor, const char *ranges_text) {
+    uint16_t pid = sensor->id.PID;
+
+    if (ranges_text) {
+        reg_range_t ranges[REG_MAP_MAX_RANGES];
+        int count = RegisterMap::parse_ranges(ranges_text, ranges, REG_MAP_MAX_RANGES);
+        if (count < 1 || !reg_map.set_ranges(pid, ranges, count)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return ESP_OK;
+    }
+
+    const reg_range_t *ranges = default_ranges;
+    int count = sizeof(default_ranges) / sizeof(default_ranges[0]);
+    if (pid == OV5640_PID || pid == OV3660_PID) {
+        ranges = ov5640_ranges;
+        count = sizeof(ov5640_ranges) / sizeof(ov5640_ranges[0]);
+    } else if (pid == OV2640_PID) {
+        ranges = ov2640_ranges;
+        count = sizeof(ov2640_ranges) / sizeof(ov2640_ranges[0]);
+    }
+    return reg_map.set_ranges(pid, ranges, count) ? ESP_OK : ESP_ERR_NO_MEM;
+}
@@ -0,0 +1,25 @@
+#ifndef REG_DUMP_H
+#define REG_DUMP_H
+
+#include <esp_err.h>
+#include <esp_camera.h>
+#include "reg_map.h"
+
+// Register map snapshots for /regdump, with default ranges per sensor PID
+class RegDump {
+  public:
+    // Use the given ranges ("0x3500-0x350d,0x3a00-0x3a25"), or the defaults for the sensor's PID when NULL
+    static esp_err_t configure(sensor_t *sensor, const char *ranges_text);
+
+    // Re-read every register and serialise a full image, or only what changed after since when delta is set.
+    // Returns the image length, 0 if out is too small.
+    static size_t snapshot(sensor_t *sensor, bool delta, uint32_t since, uint8_t *out, size_t len);
+
+  private:
+    // configure with dump_lock already held
+    static esp_err_t set_ranges(sensor_t *sensor, const char *ranges_text);
+
+    static RegisterMap reg_map;
+};
+
+#endif // REG_DUMP_H
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+#include "reg_map.h"
+#include "mem_pool.h"
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+RegisterMap::~RegisterMap() {
+    mem_region_free(values);
+    mem_region_free(changed);
+}
+
+bool RegisterMap::ensure_storage() {
+    if (!values) {
+        values = (uint8_t *)mem_region_alloc(REG_MAP_MAX_REGS, MEM_REGION_PSRAM);
+        changed = (uint32_t *)mem_region_alloc(REG_MAP_MAX_REGS * sizeof(uint32_t), MEM_REGION_PSRAM);
+    }
+    return values && changed;
+}
+
+bool RegisterMap::set_ranges(uint16_t new_pid, const reg_range_t *new_ranges, int count) {
+    if (count < 1 || count > REG_MAP_MAX_RANGES || !ensure_storage()) {
+        return false;
+    }
+
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        if (new_ranges[i].count == 0 || new_ranges[i].start + new_ranges[i].count > 0x10000) {
+            return false;
+        }
+        total += new_ranges[i].count;
+    }
+    if (total > REG_MAP_MAX_REGS) {
+        return false;
+    }
+
+    pid = new_pid;
+    memcpy(ranges, new_ranges, count * sizeof(reg_range_t));
+    range_count = count;
+    reg_count = total;
+
+    // the sequence keeps counting across range changes, so a client holding an
+    // older number simply gets everything on its next delta request
+    seq++;
+    memset(values, 0, reg_count);
+    for (int i = 0; i < reg_count; i++) {
+        changed[i] = seq;
+    }
+    return true;
+}
+
+int RegisterMap::parse_ranges(const char *text, reg_range_t *out, int max_ranges) {
+    int count = 0;
+    const char *p = text;
+
+    while (*p) {
+        char *end;
+        long start = strtol(p, &end, 0);
+        if (end == p) {
+            return -1;
+        }
+        long last = start;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 0);
+            if (end == p) {
+                return -1;
+            }
+            p = end;
+        }
+        if (start < 0 || last < start || last > 0xFFFF || count >= max_ranges) {
+            return -1;
+        }
+        out[count].start = (uint16_t)start;
+        out[count].count = (uint16_t)(last - start + 1);
+        count++;
+
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            return -1;
+        }
+    }
+    return count;
+}
+
+int RegisterMap::refresh(reg_reader_t read, void *ctx) {
+    int errors = 0;
+    bool bumped = false;
+    int i = 0;
+
+    for (int r = 0; r < range_count; r++) {
+        for (int k = 0; k < ranges[r].count; k++, i++) {
+            int v = read(ctx, ranges[r].start + k);
+            if (v < 0) {
+                errors++;
+                continue;
+            }
+            if ((uint8_t)v != values[i]) {
+                // one new sequence number per refresh, shared by everything that changed in it
+                if (!bumped) {
+                    seq++;
+                    bumped = true;
+                }
+                values[i] = (uint8_t)v;
+                changed[i] = seq;
+            }
+        }
+    }
+    return errors;
+}
+
+static size_t write_header(uint8_t *out, uint16_t pid, uint8_t kind, uint8_t ranges, uint32_t seq, uint32_t count) {
+    regdump_header_t hdr;
+    memcpy(hdr.magic, "CRD1", 4);
+    hdr.pid = pid;
+    hdr.kind = kind;
+    hdr.ranges = ranges;
+    hdr.seq = seq;
+    hdr.count = count;
+    // the target and every host we care about are little-endian
+    memcpy(out, &hdr, sizeof(hdr));
+    return sizeof(hdr);
+}
+
+size_t RegisterMap::write_full(uint8_t *out, size_t len) const {
+    size_t need = sizeof(regdump_header_t) + range_count * 4 + reg_count;
+    if (len < need) {
+        return 0;
+    }
+
+    size_t n = write_header(out, pid, REGDUMP_KIND_FULL, range_count, seq, reg_count);
+    int i = 0;
+    for (int r = 0; r < range_count; r++) {
+        put16(out + n, ranges[r].start);
+        put16(out + n + 2, ranges[r].count);
+        n += 4;
+        memcpy(out + n, values + i, ranges[r].count);
+        n += ranges[r].count;
+        i += ranges[r].count;
+    }
+    return n;
+}
+
+size_t RegisterMap::write_delta(uint32_t since, uint8_t *out, size_t len) const {
+    if (since > seq) {
+        since = 0;
+    }
+    if (len < sizeof(regdump_header_t)) {
+        return 0;
+    }
+
+    size_t n = sizeof(regdump_header_t);
+    uint32_t count = 0;
+    int i = 0;
+    for (int r = 0; r < range_count; r++) {
+        for (int k = 0; k < ranges[r].count; k++, i++) {
+            if (changed[i] <= since) {
+                continue;
+            }
+            if (n + 3 > len) {
+                return 0;
+            }
+            put16(out + n, ranges[r].start + k);
+            out[n + 2] = values[i];
+            n += 3;
+            count++;
+        }
+    }
+
+    write_header(out, pid, REGDUMP_KIND_DELTA, 0, seq, count);
+    return n;
+}
@@ -0,0 +1,74 @@
+#ifndef REG_MAP_H
+#define REG_MAP_H
+
+// Shadow copy of a set of sensor register ranges with a change sequence number
+// per register, so clients can ask for only what changed since they last looked.
+// Plain C++ with no Arduino dependency so it can be tested on the host.
+//
+// Wire format, all integers little-endian:
+//   header   regdump_header_t (16 bytes)
+//   full     per range: uint16 start, uint16 count, count value bytes
+//   delta    per changed register: uint16 address, uint8 value
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REG_MAP_MAX_RANGES 16
+#define REG_MAP_MAX_REGS 2048
+
+#define REGDUMP_KIND_FULL 0
+#define REGDUMP_KIND_DELTA 1
+
+typedef struct {
+    char magic[4];    // "CRD1"
+    uint16_t pid;     // sensor product id
+    uint8_t kind;     // REGDUMP_KIND_FULL or REGDUMP_KIND_DELTA
+    uint8_t ranges;   // number of ranges (full) or 0 (delta)
+    uint32_t seq;     // change sequence the image is current to, pass it back as since=
+    uint32_t count;   // registers in the image (full) or changed registers (delta)
+} regdump_header_t;
+
+typedef struct {
+    uint16_t start;
+    uint16_t count;
+} reg_range_t;
+
+// Reads one register, returns the value or a negative number on error
+typedef int (*reg_reader_t)(void *ctx, uint16_t reg);
+
+class RegisterMap {
+  public:
+    ~RegisterMap();
+
+    // Replace the ranges, every register counts as changed afterwards. false if they do not fit.
+    bool set_ranges(uint16_t pid, const reg_range_t *ranges, int count);
+
+    // Parse "0x3000-0x30ff,0x3500-0x350d" (inclusive ends) into ranges, returns the count or -1
+    static int parse_ranges(const char *text, reg_range_t *ranges, int max_ranges);
+
+    // Read every register, bump the sequence if anything changed. Returns the number of read errors.
+    int refresh(reg_reader_t read, void *ctx);
+
+    // Serialise into out, returns the length or 0 if out is too small.
+    // A since of 0, or one newer than the current sequence (e.g. after a reboot), gives every register.
+    size_t write_full(uint8_t *out, size_t len) const;
+    size_t write_delta(uint32_t since, uint8_t *out, size_t len) const;
+
+    uint16_t get_pid() const { return pid; }
+    uint32_t get_seq() const { return seq; }
+    int get_range_count() const { return range_count; }
+    const reg_range_t *get_ranges() const { return ranges; }
+
+  private:
+    bool ensure_storage();
+
+    uint16_t pid = 0;
+    reg_range_t ranges[REG_MAP_MAX_RANGES];
+    int range_count = 0;
+    int reg_count = 0;
+    uint8_t *values = nullptr;      // reg_count shadow values
+    uint32_t *changed = nullptr;    // reg_count sequence numbers of the last change
+    uint32_t seq = 0;
+};
+
+#endif // REG_MAP_H
@@ -0,0 +1,340 @@
+#include <string.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <esp_timer.h>
+#include "sensor_queue.h"
+#include "sensor_settings.h"
+#include "camera_hal.h"
+#include "capture_task.h"
+
+typedef enum {
+    CMD_SETTING,
+    CMD_REG_WRITE,
+    CMD_REG_READ,
+    CMD_PLL,
+    CMD_XCLK,
+    CMD_CALL,
+} cmd_type_t;
+
+typedef enum {
+    CMD_QUEUED,  // waiting for the next frame boundary
+    CMD_APPLIED, // written, waiting for the first frame captured after it
+    CMD_DONE,
+} cmd_state_t;
+
+// Lives on the submitter's stack until it is done
+typedef struct sensor_cmd {
+    cmd_type_t type;
+    const char *key;
+    int reg;
+    int mask;
+    int value;
+    int pll[8];
+    sensor_call_t fn;
+    void *ctx;
+    cmd_state_t state;
+    int64_t submitted_us;
+    int64_t applied_us;
+    sensor_result_t result;
+    struct sensor_cmd *superseded; // the queued write this one made redundant
+} sensor_cmd_t;
+
+typedef struct {
+    uint32_t batches;
+    uint32_t applied;
+    uint32_t coalesced;
+    uint32_t inline_runs;
+    uint32_t rejected;    // queue full
+    uint32_t timeouts;    // never applied in time
+    uint32_t unresolved;  // applied, but no frame seen before the submitter gave up
+    uint32_t max_batch;
+    uint32_t max_wait_us;
+} queue_stats_t;
+
+// guards both lists, the stats and the state of every queued command.
+// The capture task holds it while it applies a batch, so nothing else can get at the bus.
+static std::mutex queue_lock;
+static std::condition_variable queue_done;
+static sensor_cmd_t *pending[SENSOR_QUEUE_DEPTH];
+static int pending_count = 0;
+// applied writes waiting for their frame
+static sensor_cmd_t *waiting[SENSOR_QUEUE_DEPTH];
+static int waiting_count = 0;
+static queue_stats_t stats = {};
+
+static bool is_write(cmd_type_t type) {
+    return type == CMD_SETTING || type == CMD_REG_WRITE || type == CMD_PLL || type == CMD_XCLK;
+}
+
+static bool same_target(const sensor_cmd_t *a, const sensor_cmd_t *b) {
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+        case CMD_SETTING:   return !strcmp(a->key, b->key);
+        case CMD_REG_WRITE: return a->reg == b->reg && a->mask == b->mask;
+        case CMD_PLL:
+        case CMD_XCLK:      return true;
+        default:            return false;
+    }
+}
+
+// Raw frame buffers are sized for one frame size, changing it brings the driver down
+// and up again. That waits for the capture task, so it cannot run on the capture task.
+static bool needs_reinit(const sensor_cmd_t *cmd) {
+    return cmd->type == CMD_SETTING && !strcmp(cmd->key, "framesize") && CameraHal::get_format() != PIXFORMAT_JPEG;
+}
+
+static void execute(sensor_t *sensor, sensor_cmd_t *cmd) {
+    if (!sensor) {
+        cmd->result.res = ESP_ERR_INVALID_STATE;
+        return;
+    }
+
+    switch (cmd->type) {
+        case CMD_SETTING:
+            cmd->result.res = sensor_apply_setting(sensor, cmd->key, cmd->value);
+            break;
+        case CMD_REG_WRITE:
+            cmd->result.res = sensor->set_reg(sensor, cmd->reg, cmd->mask, cmd->value);
+            break;
+        case CMD_REG_READ:
+            cmd->result.value = sensor->get_reg(sensor, cmd->reg, cmd->mask);
+            cmd->result.res = cmd->result.value < 0 ? cmd->result.value : 0;
+            break;
+        case CMD_PLL:
+            cmd->result.res = sensor->set_pll(sensor, cmd->pll[0], cmd->pll[1], cmd->pll[2], cmd->pll[3],
+                                              cmd->pll[4], cmd->pll[5], cmd->pll[6], cmd->pll[7]);
+            break;
+        case CMD_XCLK:
+            cmd->result.res = sensor->set_xclk(sensor, LEDC_TIMER_0, cmd->value);
+            break;
+        case CMD_CALL:
+            cmd->result.res = cmd->fn(sensor, cmd->ctx);
+            break;
+    }
+}
+
+static void finish(sensor_cmd_t *cmd, uint32_t seq) {
+    cmd->result.seq = seq;
+    cmd->state = CMD_DONE;
+}
+
+static esp_err_t submit(sensor_cmd_t *cmd, sensor_result_t *result) {
+    cmd->result = {};
+    cmd->state = CMD_QUEUED;
+    cmd->submitted_us = esp_timer_get_time();
+
+    // before the capture task is up there is nobody to race with, and the capture
+    // task itself would wait for itself. Reinit holds the capture task off on its own.
+    TaskHandle_t capture = CaptureTask::get_handle();
+    if (!capture || capture == xTaskGetCurrentTaskHandle() || needs_reinit(cmd)) {
+        if (capture == xTaskGetCurrentTaskHandle() && needs_reinit(cmd)) {
+            cmd->result.res = ESP_ERR_INVALID_STATE;
+        } else {
+            execute(CameraHal::get_sensor(), cmd);
+        }
+        {
+            std::lock_guard<std::mutex> guard(queue_lock);
+            stats.inline_runs++;
+        }
+        *result = cmd->result;
+        return ESP_OK;
+    }
+
+    std::unique_lock<std::mutex> guard(queue_lock);
+    if (pending_count >= SENSOR_QUEUE_DEPTH) {
+        stats.rejected++;
+        return ESP_ERR_NO_MEM;
+    }
+
+    // a read or call queued in between must still see the earlier write, so only look back that far
+    if (is_write(cmd->type)) {
+        for (int i = pending_count - 1; i >= 0 && is_write(pending[i]->type); i--) {
+            if (!pending[i]->result.coalesced && same_target(pending[i], cmd)) {
+                pending[i]->result.coalesced = true;
+                cmd->superseded = pending[i];
+                break;
+            }
+        }
+    }
+    pending[pending_count++] = cmd;
+
+    queue_done.wait_for(guard, std::chrono::milliseconds(SENSOR_QUEUE_TIMEOUT_MS), [cmd] {
+        return cmd->state == CMD_DONE;
+    });
+
+    // on a timeout the command is still in one of the lists, take it out before our stack frame goes away
+    esp_err_t err = ESP_OK;
+    if (cmd->state == CMD_QUEUED) {
+        for (int i = 0; i < pending_count; i++) {
+            if (pending[i] == cmd) {
+                memmove(&pending[i], &pending[i + 1], (pending_count - i - 1) * sizeof(pending[0]));
+                pending_count--;
+                break;
+            }
+        }
+        // a later write that replaced this one takes over what it replaced, with none
+        // the write this one replaced has to reach the sensor after all
+        sensor_cmd_t *replacement = nullptr;
+        for (int i = 0; i < pending_count; i++) {
+            if (pending[i]->superseded == cmd) {
+                replacement = pending[i];
+            }
+        }
+        if (replacement) {
+            replacement->superseded = cmd->superseded;
+        } else if (cmd->superseded) {
+            cmd->superseded->result.coalesced = false;
+        }
+        stats.timeouts++;
+        err = ESP_ERR_TIMEOUT;
+    } else if (cmd->state == CMD_APPLIED) {
+        // it did reach the sensor, we just never saw a frame after it
+        for (int i = 0; i < waiting_count; i++) {
+            if (waiting[i] == cmd) {
+                waiting[i] = waiting[--waiting_count];
+                break;
+            }
+        }
+        stats.unresolved++;
+    }
+
+    *result = cmd->result;
+    return err;
+}
+
+//public
+
+esp_err_t SensorQueue::setting(const char *key, int value, sensor_result_t *result) {
+    sensor_cmd_t cmd = {};
+    cmd.type = CMD_SETTING;
+    cmd.key = key;
+    cmd.value = value;
+    return submit(&cmd, result);
+}
+
+esp_err_t SensorQueue::write_reg(int reg, int mask, int value, sensor_result_t *result) {
+    sensor_cmd_t cmd = {};
+    cmd.type = CMD_REG_WRITE;
+    cmd.reg = reg;
+    cmd.mask = mask;
+    cmd.value = value;
+    return submit(&cmd, result);
+}
+
+esp_err_t SensorQueue::read_reg(int reg, int mask, sensor_result_t *result) {
+    sensor_cmd_t cmd = {};
+    cmd.type = CMD_REG_READ;
+    cmd.reg = reg;
+    cmd.mask = mask;
+    return submit(&cmd, result);
+}
+
+esp_err_t SensorQueue::set_pll(const int pll[8], sensor_result_t *result) {
+    sensor_cmd_t cmd = {};
+    cmd.type = CMD_PLL;
+    memcpy(cmd.pll, pll, sizeof(cmd.pll));
+    return submit(&cmd, result);
+}
+
+esp_err_t SensorQueue::set_xclk(int mhz, sensor_result_t *result) {
+    sensor_cmd_t cmd = {};
+    cmd.type = CMD_XCLK;
+    cmd.value = mhz;
+    return submit(&cmd, result);
+}
+
+esp_err_t SensorQueue::call(sensor_call_t fn, void *ctx, sensor_result_t *result) {
+    sensor_cmd_t cmd = {};
+    cmd.type = CMD_CALL;
+    cmd.fn = fn;
+    cmd.ctx = ctx;
+    return submit(&cmd, result);
+}
+
+void SensorQueue::apply_pending(bool capturing) {
+    std::lock_guard<std::mutex> guard(queue_lock);
+
+    bool changed = false;
+    if (!capturing) {
+        // no frames are coming, whoever waits for one gets no sequence
+        for (int i = 0; i < waiting_count; i++) {
+            finish(waiting[i], 0);
+        }
+        changed = waiting_count > 0;
+        waiting_count = 0;
+    }
+
+    if (pending_count > 0) {
+        sensor_t *sensor = CameraHal::get_sensor();
+        for (int i = 0; i < pending_count; i++) {
+            sensor_cmd_t *cmd = pending[i];
+            if (cmd->result.coalesced) {
+                stats.coalesced++;
+            } else {
+                execute(sensor, cmd);
+                stats.applied++;
+            }
+            cmd->applied_us = esp_timer_get_time();
+            cmd->result.wait_us = (uint32_t)(cmd->applied_us - cmd->submitted_us);
+            if (cmd->result.wait_us > stats.max_wait_us) {
+                stats.max_wait_us = cmd->result.wait_us;
+            }
+
+            // only a successful write changes what the frames look like
+            if (capturing && is_write(cmd->type) && cmd->result.res == 0 && waiting_count < SENSOR_QUEUE_DEPTH) {
+                cmd->state = CMD_APPLIED;
+                waiting[waiting_count++] = cmd;
+            } else {
+                finish(cmd, 0);
+            }
+        }
+        stats.batches++;
+        if ((uint32_t)pending_count > stats.max_batch) {
+            stats.max_batch = pending_count;
+        }
+        pending_count = 0;
+        changed = true;
+    }
+
+    if (changed) {
+        queue_done.notify_all();
+    }
+}
+
+void SensorQueue::frame_started(uint32_t seq, const struct timeval &timestamp) {
+    // the driver stamps frames with esp_timer time at the start of the frame
+    int64_t started_us = (int64_t)timestamp.tv_sec * 1000000LL + timestamp.tv_usec;
+
+    std::lock_guard<std::mutex> guard(queue_lock);
+    bool changed = false;
+    for (int i = 0; i < waiting_count; ) {
+        if (waiting[i]->applied_us < started_us) {
+            finish(waiting[i], seq);
+            waiting[i] = waiting[--waiting_count];
+            changed = true;
+        } else {
+            i++;
+        }
+    }
+    if (changed) {
+        queue_done.notify_all();
+    }
+}
+
+int SensorQueue::write_metrics(char *out, size_t len) {
+    queue_stats_t s;
+    int pending_now;
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        s = stats;
+        pending_now = pending_count;
+    }
+    return snprintf(out, len,
+        "\"sccb\":{\"pending\":%d,\"batches\":%u,\"applied\":%u,\"coalesced\":%u,\"inline\":%u,"
+        "\"rejected\":%u,\"timeouts\":%u,\"unresolved\":%u,\"max_batch\":%u,\"max_wait_us\":%u}",
+        pending_now, s.batches, s.applied, s.coalesced, s.inline_runs,
+        s.rejected, s.timeouts, s.unresolved, s.max_batch, s.max_wait_us);
+}
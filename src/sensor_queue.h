@@ -0,0 +1,60 @@
+#ifndef SENSOR_QUEUE_H
+#define SENSOR_QUEUE_H
+
+#include <Arduino.h>
+#include <esp_err.h>
+#include <esp_camera.h>
+
+// Commands waiting for the next frame boundary, submitters get ESP_ERR_NO_MEM beyond that
+#ifndef SENSOR_QUEUE_DEPTH
+#define SENSOR_QUEUE_DEPTH 16
+#endif
+
+// How long a submitter waits for its command to be applied and show up in a frame
+#ifndef SENSOR_QUEUE_TIMEOUT_MS
+#define SENSOR_QUEUE_TIMEOUT_MS 3000
+#endif
+
+// Runs on the capture task with exclusive access to the sensor bus
+typedef int (*sensor_call_t)(sensor_t *sensor, void *ctx);
+
+typedef struct {
+    int res;           // what the driver returned, -1 for an unknown setting key
+    int value;         // read_reg: the value read
+    uint32_t seq;      // first frame whose capture started after the change landed, 0 if not known
+    bool coalesced;    // replaced by a later write to the same target before it reached the sensor
+    uint32_t wait_us;  // time from submit until the command was applied
+} sensor_result_t;
+
+// Every access to the sensor bus (SCCB) goes through here. Commands queue up and the
+// capture task applies them as one batch right after it got a frame from the driver,
+// which is right after VSYNC, so a write never lands in the middle of a frame that we
+// already hold. A write to the same register, setting, PLL or clock as one still
+// waiting replaces it. Each call blocks until its command ran, writes also wait
+// until the first frame captured after them, so the caller can report its sequence.
+//
+// Without a running capture task, or when called from the capture task itself,
+// commands run right away in the caller.
+class SensorQueue {
+  public:
+    // Same keys as /control, see sensor_apply_setting
+    static esp_err_t setting(const char *key, int value, sensor_result_t *result);
+    static esp_err_t write_reg(int reg, int mask, int value, sensor_result_t *result);
+    static esp_err_t read_reg(int reg, int mask, sensor_result_t *result);
+    // bypass, mul, sys, root, pre, seld5, pclken, pclk
+    static esp_err_t set_pll(const int pll[8], sensor_result_t *result);
+    static esp_err_t set_xclk(int mhz, sensor_result_t *result);
+    // Anything else, e.g. reading a whole block of registers in one go
+    static esp_err_t call(sensor_call_t fn, void *ctx, sensor_result_t *result);
+
+    // Capture task only: apply everything queued. While capture is paused there is
+    // no frame to wait for, the commands complete straight away without a sequence.
+    static void apply_pending(bool capturing);
+    // Capture task only: a frame was numbered, resolves the writes it reflects
+    static void frame_started(uint32_t seq, const struct timeval &timestamp);
+
+    // Write the "sccb" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+};
+
+#endif // SENSOR_QUEUE_H
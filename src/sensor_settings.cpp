@@ -0,0 +1,105 @@
+#include <string.h>
+#include "sensor_settings.h"
+#include "camera_hal.h"
+
+typedef struct setting_handler_t {
+    //pointer to the setting string
+    const char *key;
+    //pointer to function that sets the variable
+    //passing two arguments, the camera sensor struct ( im sensor.h), and val to set
+    int (*handler)(sensor_t *, int);
+    //pointer to function that reads the value back from the driver's status cache
+    int (*getter)(sensor_t *);
+} setting_handler_t;
+
+// We could set the variables using strcmp and a big if-else block,
+// but there is a better way with dispatch tables and lambda functions
+
+// Each key associates a lambda function that takes a pointer to the sensor struct and an val to set
+// The lambda then calls the setter function on for each paramter to update that particular setting.
+static const setting_handler_t handlers[] = {
+    // raw frame buffers are sized for one frame size, so the driver has to be brought up again
+    { "framesize", [](sensor_t *s, int val) {
+        if (val < 0 || val >= FRAMESIZE_INVALID) {
+            return -1;
+        }
+        return s->pixformat == PIXFORMAT_JPEG ? s->set_framesize(s, (framesize_t)val)
+                                              : CameraHal::set_format(s->pixformat, (framesize_t)val);
+    }, [](sensor_t *s) { return (int)s->status.framesize; } },
+    //key              []inherit nothing into the lambda function, (sensor_t *s, int val) the function takes two parameters.
+    { "contrast",      [](sensor_t *s, int val) { return s->set_contrast(s, val); },
+                       [](sensor_t *s) { return (int)s->status.contrast; } },
+    { "brightness",    [](sensor_t *s, int val) { return s->set_brightness(s, val); },
+                       [](sensor_t *s) { return (int)s->status.brightness; } },
+    { "saturation",    [](sensor_t *s, int val) { return s->set_saturation(s, val); },
+                       [](sensor_t *s) { return (int)s->status.saturation; } },
+    { "gainceiling",   [](sensor_t *s, int val) { return s->set_gainceiling(s, (gainceiling_t)val); },
+                       [](sensor_t *s) { return (int)s->status.gainceiling; } },
+    { "quality",       [](sensor_t *s, int val) { return s->set_quality(s, val); },
+                       [](sensor_t *s) { return (int)s->status.quality; } },
+    { "colorbar",      [](sensor_t *s, int val) { return s->set_colorbar(s, val); },
+                       [](sensor_t *s) { return (int)s->status.colorbar; } },
+    { "awb",           [](sensor_t *s, int val) { return s->set_whitebal(s, val); },
+                       [](sensor_t *s) { return (int)s->status.awb; } },
+    { "agc",           [](sensor_t *s, int val) { return s->set_gain_ctrl(s, val); },
+                       [](sensor_t *s) { return (int)s->status.agc; } },
+    { "aec",           [](sensor_t *s, int val) { return s->set_exposure_ctrl(s, val); },
+                       [](sensor_t *s) { return (int)s->status.aec; } },
+    { "hmirror",       [](sensor_t *s, int val) { return s->set_hmirror(s, val); },
+                       [](sensor_t *s) { return (int)s->status.hmirror; } },
+    { "vflip",         [](sensor_t *s, int val) { return s->set_vflip(s, val); },
+                       [](sensor_t *s) { return (int)s->status.vflip; } },
+    { "aec2",          [](sensor_t *s, int val) { return s->set_aec2(s, val); },
+                       [](sensor_t *s) { return (int)s->status.aec2; } },
+    { "awb_gain",      [](sensor_t *s, int val) { return s->set_awb_gain(s, val); },
+                       [](sensor_t *s) { return (int)s->status.awb_gain; } },
+    { "agc_gain",      [](sensor_t *s, int val) { return s->set_agc_gain(s, val); },
+                       [](sensor_t *s) { return (int)s->status.agc_gain; } },
+    { "aec_value",     [](sensor_t *s, int val) { return s->set_aec_value(s, val); },
+                       [](sensor_t *s) { return (int)s->status.aec_value; } },
+    { "special_effect",[](sensor_t *s, int val) { return s->set_special_effect(s, val); },
+                       [](sensor_t *s) { return (int)s->status.special_effect; } },
+    { "wb_mode",       [](sensor_t *s, int val) { return s->set_wb_mode(s, val); },
+                       [](sensor_t *s) { return (int)s->status.wb_mode; } },
+    { "ae_level",      [](sensor_t *s, int val) { return s->set_ae_level(s, val); },
+                       [](sensor_t *s) { return (int)s->status.ae_level; } },
+    { "dcw",           [](sensor_t *s, int val) { return s->set_dcw(s, val); },
+                       [](sensor_t *s) { return (int)s->status.dcw; } },
+    { "bpc",           [](sensor_t *s, int val) { return s->set_bpc(s, val); },
+                       [](sensor_t *s) { return (int)s->status.bpc; } },
+    { "wpc",           [](sensor_t *s, int val) { return s->set_wpc(s, val); },
+                       [](sensor_t *s) { return (int)s->status.wpc; } },
+    { "raw_gma",       [](sensor_t *s, int val) { return s->set_raw_gma(s, val); },
+                       [](sensor_t *s) { return (int)s->status.raw_gma; } },
+    { "lenc",          [](sensor_t *s, int val) { return s->set_lenc(s, val); },
+                       [](sensor_t *s) { return (int)s->status.lenc; } }
+};
+
+// Get the number of handlers in the handlers struct
+#define NUM_HANDLERS (sizeof(handlers) / sizeof(handlers[0]))
+
+static const setting_handler_t *find_handler(const char *key) {
+    for (size_t i = 0; i < NUM_HANDLERS; i++) {
+        if (!strcmp(key, handlers[i].key)) {
+            return &handlers[i];
+        }
+    }
+    return nullptr;
+}
+
+int sensor_apply_setting(sensor_t *sensor, const char *key, int value) {
+    const setting_handler_t *h = find_handler(key);
+    if (!h) {
+        return -1;
+    }
+    return h->handler(sensor, value);
+}
+
+bool sensor_read_setting(sensor_t *sensor, const char *key, int *value) {
+    const setting_handler_t *h = find_handler(key);
+    if (!h) {
+        return false;
+    }
+    *value = h->getter(sensor);
+    return true;
+}
@@ -0,0 +1,15 @@
+#ifndef SENSOR_SETTINGS_H
+#define SENSOR_SETTINGS_H
+
+#include <esp_camera.h>
+
+// The named sensor settings understood by /control, shared with anything else
+// that changes settings by name (e.g. /sweep).
+
+// Apply a setting, returns -1 for an unknown key, otherwise the driver's result (0 = success)
+int sensor_apply_setting(sensor_t *sensor, const char *key, int value);
+
+// Read back the value the driver last applied for a setting, returns false for an unknown key
+bool sensor_read_setting(sensor_t *sensor, const char *key, int *value);
+
+#endif // SENSOR_SETTINGS_H
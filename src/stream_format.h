@@ -0,0 +1,15 @@
+#ifndef STREAM_FORMAT_H
+#define STREAM_FORMAT_H
+
+// Multipart framing shared by /stream and /sweep
+
+// A unique string that separates individual JPEG frames in a multipart MIME stream
+#define PART_BOUNDARY "123456789000000000000987654321"
+static const char _STREAM_CONTENT_TYPE[] = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
+static const char _STREAM_BOUNDARY[] = "\r\n--" PART_BOUNDARY "\r\n";
+// X-Timestamp is the SNTP disciplined capture time, X-Sequence the capture sequence number (gaps are dropped frames)
+static const char _STREAM_PART[] = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06ld\r\nX-Sequence: %u\r\n\r\n";
+// same as _STREAM_PART, plus the exposure summary from ExposureStats::write_header
+static const char _STREAM_PART_LUMA[] = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06ld\r\nX-Sequence: %u\r\nX-Luma: %s\r\n\r\n";
+
+#endif // STREAM_FORMAT_H
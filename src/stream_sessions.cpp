@@ -0,0 +1,423 @@
+#include <string.h>
+#include <mutex>
+#include <atomic>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include "stream_sessions.h"
+#include "stream_format.h"
+#include "capture_task.h"
+#include "exposure_stats.h"
+#include "token_bucket.h"
+#include "tls_sessions.h"
+#include "wall_clock.h"
+#include "task_config.h"
+#include "task_monitor.h"
+
+httpd_handle_t StreamSessions::server = NULL;
+
+// how long a worker waits for the capture task to publish a frame before giving up on the stream
+#define STREAM_FRAME_TIMEOUT_MS 3000
+// achieved rates in /metrics are averaged over this window
+#define STREAM_RATE_WINDOW_US 1000000LL
+// largest single socket write, on_close waits for at most one of these
+#define STREAM_SEND_CHUNK 4096
+
+static const char _STREAM_RESPONSE[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: %s\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Cache-Control: no-store\r\n"
+    "Connection: close\r\n\r\n";
+
+static const char _FRAME_RESPONSE[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: image/jpeg\r\n"
+    "Content-Length: %u\r\n"
+    "Content-Disposition: inline; filename=frame.jpg\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "X-Timestamp: %lld.%06ld\r\n"
+    "X-Sequence: %u\r\n"
+    "X-Clock-Synced: %d\r\n"
+    "%s"
+    "Connection: close\r\n\r\n";
+
+static const char _FRAME_TIMEOUT_RESPONSE[] =
+    "HTTP/1.1 504 Gateway Timeout\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 16\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Connection: close\r\n\r\n"
+    "No frame in time";
+
+struct stream_session {
+    TaskHandle_t task;
+    // held around each write to the socket, on_close takes it before the socket goes away
+    std::mutex send_lock;
+    int fd;                  // -1 while the slot is free
+    std::atomic<bool> closed; // the server closed the socket, do not touch fd any more
+    bool one_frame;          // a /frame long-poll rather than a stream
+    stream_job_t job;        // or some other response, run by job
+    const char *kind;        // for /metrics
+    stream_params_t params;
+    frame_request_t frame_request;
+    alignas(8) uint8_t job_arg[STREAM_JOB_ARG_SIZE];
+    char peer[48];
+    int64_t started_us;
+    uint32_t frames;
+    uint32_t missed;         // frames published while this client was still busy or paced
+    uint64_t bytes;
+    int64_t window_start_us;
+    uint32_t window_frames;
+    uint64_t window_bytes;
+    uint32_t fps_x100;       // achieved over the last window
+    uint32_t kbps;
+};
+
+// guards slot assignment, the counters and the per session stats
+static std::mutex slots_lock;
+static stream_session_t sessions[STREAM_MAX_SESSIONS];
+static uint32_t admitted = 0;
+static uint32_t rejected = 0;
+
+// Write all of buf, false once the client is gone
+static bool send_all(httpd_handle_t server, stream_session_t *s, const char *buf, size_t len) {
+    while (len > 0) {
+        // the lock only covers one chunk, so closing the session never waits for a whole frame
+        std::lock_guard<std::mutex> guard(s->send_lock);
+        if (s->closed) {
+            return false;
+        }
+        int sent = httpd_socket_send(server, s->fd, buf, len < STREAM_SEND_CHUNK ? len : STREAM_SEND_CHUNK, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+static void peer_name(int fd, char *out, size_t len) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    out[0] = 0;
+    if (getpeername(fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        return;
+    }
+    if (addr.ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&addr)->sin6_addr, out, len);
+    } else {
+        inet_ntop(AF_INET, &((struct sockaddr_in *)&addr)->sin_addr, out, len);
+    }
+}
+
+static void count_frame(stream_session_t *s, size_t bytes, int64_t now) {
+    std::lock_guard<std::mutex> guard(slots_lock);
+    s->frames++;
+    s->bytes += bytes;
+    s->window_frames++;
+    s->window_bytes += bytes;
+
+    int64_t elapsed = now - s->window_start_us;
+    if (elapsed >= STREAM_RATE_WINDOW_US) {
+        s->fps_x100 = (uint32_t)(s->window_frames * 100000000LL / elapsed);
+        s->kbps = (uint32_t)(s->window_bytes * 8000 / elapsed);
+        s->window_start_us = now;
+        s->window_frames = 0;
+        s->window_bytes = 0;
+    }
+}
+
+// Send multipart parts until the client goes away or the camera stops delivering
+static void serve(httpd_handle_t server, stream_session_t *s) {
+    char part_buf[192];
+
+    int part_len = snprintf(part_buf, sizeof(part_buf), _STREAM_RESPONSE, _STREAM_CONTENT_TYPE);
+    if (!send_all(server, s, part_buf, part_len)) {
+        return;
+    }
+
+    // fps caps frames, maxkbps caps bytes, both refill continuously
+    int64_t now = esp_timer_get_time();
+    token_bucket_t frame_bucket;
+    token_bucket_t byte_bucket;
+    // in 64 bit, maxkbps above 4294967 would wrap, clamp what does not fit the bucket
+    uint64_t byte_rate = (uint64_t)s->params.max_kbps * 1000 / 8;
+    uint64_t byte_burst = byte_rate * STREAM_BURST_MS / 1000;
+    token_bucket_init(&frame_bucket, s->params.fps, 1, now);
+    token_bucket_init(&byte_bucket, byte_rate > UINT32_MAX ? UINT32_MAX : (uint32_t)byte_rate,
+                      byte_burst > UINT32_MAX ? UINT32_MAX : (uint32_t)byte_burst, now);
+
+    uint32_t last_seq = CaptureTask::latest_seq();
+    while (true) {
+        now = esp_timer_get_time();
+        int64_t wait_us = token_bucket_delay_us(&frame_bucket, now);
+        int64_t byte_wait_us = token_bucket_delay_us(&byte_bucket, now);
+        wait_us = byte_wait_us > wait_us ? byte_wait_us : wait_us;
+        if (wait_us > 0) {
+            vTaskDelay(pdMS_TO_TICKS((wait_us + 999) / 1000));
+        }
+
+        frame_t *frame = CaptureTask::acquire_next(last_seq, STREAM_FRAME_TIMEOUT_MS);
+        if (!frame) {
+            Serial.println("Stream: no frame from the capture task, closing");
+            return;
+        }
+        uint32_t missed = last_seq && frame->seq > last_seq + 1 ? frame->seq - last_seq - 1 : 0;
+        last_seq = frame->seq;
+
+        part_len = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, (unsigned)frame->len,
+            (long long)frame->wall.tv_sec, (long)frame->wall.tv_usec, frame->seq);
+
+        luma_stats_t stats;
+        if (s->params.with_stats && ExposureStats::latest(&stats)) {
+            char luma[64];
+            ExposureStats::write_header(luma, sizeof(luma), stats);
+            part_len = snprintf(part_buf, sizeof(part_buf), _STREAM_PART_LUMA, (unsigned)frame->len,
+                (long long)frame->wall.tv_sec, (long)frame->wall.tv_usec, frame->seq, luma);
+        }
+
+        // over TLS, whatever the send took beyond the socket writes went to encrypting the frame
+        bool tls = TlsSessions::active();
+        int64_t send_start = esp_timer_get_time();
+        int64_t socket_start = tls ? TlsSessions::socket_time_us() : 0;
+
+        size_t sent = strlen(_STREAM_BOUNDARY) + part_len + frame->len;
+        bool ok = send_all(server, s, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY)) &&
+                  send_all(server, s, part_buf, part_len) &&
+                  send_all(server, s, (const char *)frame->buf, frame->len);
+        CaptureTask::release(frame);
+        if (!ok) {
+            return;
+        }
+
+        now = esp_timer_get_time();
+        if (tls) {
+            TlsSessions::count_frame(sent, now - send_start - (TlsSessions::socket_time_us() - socket_start));
+        }
+        token_bucket_take(&frame_bucket, 1, now);
+        token_bucket_take(&byte_bucket, sent, now);
+        count_frame(s, sent, now);
+        if (missed) {
+            std::lock_guard<std::mutex> guard(slots_lock);
+            s->missed += missed;
+        }
+    }
+}
+
+// Wait for the one frame a /frame long-poll asked for and answer with it
+static void serve_frame(httpd_handle_t server, stream_session_t *s) {
+    const frame_request_t &r = s->frame_request;
+    int64_t delta_us = 0;
+    frame_t *frame = r.by_time ? CaptureTask::acquire_nearest(r.at, r.timeout_ms, &delta_us)
+                               : CaptureTask::acquire_after(r.after, r.timeout_ms);
+    if (!frame) {
+        // nothing in time, tell the client to poll again rather than treating it as an error
+        send_all(server, s, _FRAME_TIMEOUT_RESPONSE, strlen(_FRAME_TIMEOUT_RESPONSE));
+        return;
+    }
+
+    // how far the frame is from the requested time, negative means before it
+    char delta_header[48] = "";
+    if (r.by_time) {
+        snprintf(delta_header, sizeof(delta_header), "X-Time-Delta-Us: %lld\r\n", (long long)delta_us);
+    }
+    char head[384];
+    int head_len = snprintf(head, sizeof(head), _FRAME_RESPONSE, (unsigned)frame->len,
+        (long long)frame->wall.tv_sec, (long)frame->wall.tv_usec, frame->seq, WallClock::synced() ? 1 : 0,
+        delta_header);
+
+    bool ok = send_all(server, s, head, head_len) &&
+              send_all(server, s, (const char *)frame->buf, frame->len);
+    CaptureTask::release(frame);
+    if (ok) {
+        count_frame(s, head_len + frame->len, esp_timer_get_time());
+    }
+}
+
+// Give the request's socket to an idle worker, for a stream with params, for one
+// frame with request, or for a job. NULL when every session is busy.
+static stream_session_t *claim(httpd_req_t *req, const stream_params_t *params, const frame_request_t *request,
+                               stream_job_t job = nullptr, const char *kind = nullptr) {
+    int fd = httpd_req_to_sockfd(req);
+
+    std::lock_guard<std::mutex> guard(slots_lock);
+    stream_session_t *s = nullptr;
+    for (int i = 0; i < STREAM_MAX_SESSIONS && !s; i++) {
+        if (sessions[i].fd < 0 && sessions[i].task) {
+            s = &sessions[i];
+        }
+    }
+    if (!s) {
+        rejected++;
+        return nullptr;
+    }
+    admitted++;
+
+    s->fd = fd;
+    s->closed = false;
+    s->one_frame = request != nullptr;
+    s->job = job;
+    s->kind = job ? kind : request ? "frame" : "stream";
+    s->params = params ? *params : stream_params_t{};
+    if (request) {
+        s->frame_request = *request;
+    }
+    s->started_us = esp_timer_get_time();
+    s->frames = 0;
+    s->missed = 0;
+    s->bytes = 0;
+    s->window_start_us = s->started_us;
+    s->window_frames = 0;
+    s->window_bytes = 0;
+    s->fps_x100 = 0;
+    s->kbps = 0;
+    peer_name(fd, s->peer, sizeof(s->peer));
+    return s;
+}
+
+//public
+
+esp_err_t StreamSessions::init(httpd_handle_t httpd) {
+    server = httpd;
+    for (int i = 0; i < STREAM_MAX_SESSIONS; i++) {
+        sessions[i].fd = -1;
+        char name[16];
+        snprintf(name, sizeof(name), "stream%d", i);
+        BaseType_t res = xTaskCreatePinnedToCore(run, name, STREAM_TASK_STACK, &sessions[i],
+                                                 STREAM_TASK_PRIORITY, &sessions[i].task, NET_CORE);
+        if (res != pdPASS) {
+            return ESP_FAIL;
+        }
+        TaskMonitor::watch(sessions[i].task);
+    }
+    return ESP_OK;
+}
+
+esp_err_t StreamSessions::admit(httpd_req_t *req, const stream_params_t &params) {
+    stream_session_t *s = claim(req, &params, nullptr);
+    if (!s) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    Serial.printf("Stream: %s admitted, fps=%u maxkbps=%u\n", s->peer, params.fps, params.max_kbps);
+    xTaskNotifyGive(s->task);
+    return ESP_OK;
+}
+
+esp_err_t StreamSessions::admit_frame(httpd_req_t *req, const frame_request_t &request) {
+    stream_session_t *s = claim(req, nullptr, &request);
+    if (!s) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(s->task);
+    return ESP_OK;
+}
+
+esp_err_t StreamSessions::admit_job(httpd_req_t *req, const char *kind, stream_job_t job,
+                                   const void *arg, size_t arg_len) {
+    if (arg_len > STREAM_JOB_ARG_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    stream_session_t *s = claim(req, nullptr, nullptr, job, kind);
+    if (!s) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(s->job_arg, arg, arg_len);
+    xTaskNotifyGive(s->task);
+    return ESP_OK;
+}
+
+bool StreamSessions::job_begin(stream_session_t *session, const char *content_type) {
+    char head[192];
+    int head_len = snprintf(head, sizeof(head), _STREAM_RESPONSE, content_type);
+    return send_all(server, session, head, head_len);
+}
+
+bool StreamSessions::job_send(stream_session_t *session, const char *buf, size_t len) {
+    return send_all(server, session, buf, len);
+}
+
+void StreamSessions::job_count_frame(stream_session_t *session, size_t bytes) {
+    count_frame(session, bytes, esp_timer_get_time());
+}
+
+void StreamSessions::on_close(httpd_handle_t hd, int fd) {
+    {
+        std::lock_guard<std::mutex> guard(slots_lock);
+        for (int i = 0; i < STREAM_MAX_SESSIONS; i++) {
+            if (sessions[i].fd == fd) {
+                // the worker sees closed before its next chunk. Shutting the socket down makes
+                // a chunk stuck on a stalled client fail now, so the wait below stays short.
+                sessions[i].closed = true;
+                shutdown(fd, SHUT_RDWR);
+                std::lock_guard<std::mutex> send_guard(sessions[i].send_lock);
+            }
+        }
+    }
+    // with a close_fn installed httpd leaves closing the socket to us
+    close(fd);
+}
+
+int StreamSessions::write_metrics(char *out, size_t len) {
+    std::lock_guard<std::mutex> guard(slots_lock);
+
+    int active = 0;
+    for (int i = 0; i < STREAM_MAX_SESSIONS; i++) {
+        active += sessions[i].fd >= 0;
+    }
+
+    size_t n = snprintf(out, len, "\"streams\":{\"max\":%d,\"active\":%d,\"admitted\":%u,\"rejected\":%u,\"sessions\":[",
+        STREAM_MAX_SESSIONS, active, admitted, rejected);
+
+    int64_t now = esp_timer_get_time();
+    bool first = true;
+    for (int i = 0; i < STREAM_MAX_SESSIONS && n < len; i++) {
+        const stream_session_t *s = &sessions[i];
+        if (s->fd < 0) {
+            continue;
+        }
+        n += snprintf(out + n, len - n,
+            "%s{\"slot\":%d,\"kind\":\"%s\",\"peer\":\"%s\",\"fps_cap\":%u,\"kbps_cap\":%u,\"fps\":%u.%02u,\"kbps\":%u,"
+            "\"frames\":%u,\"missed\":%u,\"bytes\":%llu,\"age_s\":%lld}",
+            first ? "" : ",", i, s->kind, s->peer, s->params.fps, s->params.max_kbps,
+            s->fps_x100 / 100, s->fps_x100 % 100, s->kbps,
+            s->frames, s->missed, (unsigned long long)s->bytes, (long long)((now - s->started_us) / 1000000));
+        first = false;
+    }
+    if (n < len) {
+        n += snprintf(out + n, len - n, "]}");
+    }
+    return n;
+}
+
+//private
+
+void StreamSessions::run(void *arg) {
+    stream_session_t *s = (stream_session_t *)arg;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (s->job) {
+            s->job(s, s->job_arg);
+        } else if (s->one_frame) {
+            serve_frame(server, s);
+        } else {
+            serve(server, s);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(slots_lock);
+            std::lock_guard<std::mutex> send_guard(s->send_lock);
+            // if the server already closed the socket its number may belong to someone else by now
+            if (!s->closed) {
+                httpd_sess_trigger_close(server, s->fd);
+            }
+            s->fd = -1;
+        }
+        if (!s->one_frame && !s->job) {
+            Serial.printf("Stream: %s closed after %u frames\n", s->peer, s->frames);
+        }
+    }
+}
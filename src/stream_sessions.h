@@ -0,0 +1,81 @@
+#ifndef STREAM_SESSIONS_H
+#define STREAM_SESSIONS_H
+
+#include <Arduino.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+// Concurrent /stream clients, waiting /frame long-polls and /raw and /sweep responses, one
+// worker task each. Further clients get a 503 straight away.
+// httpd keeps 7 sockets by default, the rest stay available for control requests.
+#ifndef STREAM_MAX_SESSIONS
+#define STREAM_MAX_SESSIONS 3
+#endif
+
+// How much a byte-capped stream may send in one go after being idle
+#ifndef STREAM_BURST_MS
+#define STREAM_BURST_MS 250
+#endif
+
+typedef struct {
+    uint32_t fps;      // most frames per second, 0 for as many as the camera delivers
+    uint32_t max_kbps; // most kilobits per second, 0 for no limit
+    bool with_stats;   // add the X-Luma header to every part
+} stream_params_t;
+
+// A /frame long-poll that had to wait for its frame
+typedef struct {
+    uint32_t after;          // the oldest frame newer than this
+    bool by_time;            // or, the frame closest to at
+    struct timeval at;
+    uint32_t timeout_ms;
+} frame_request_t;
+
+// Any other long response, run on a worker with admit_job. The job writes the whole
+// HTTP response, starting with job_begin, and the session closes the socket after it.
+typedef struct stream_session stream_session_t;
+typedef void (*stream_job_t)(stream_session_t *session, void *arg);
+
+// Most bytes of job argument admit_job copies into the session
+#define STREAM_JOB_ARG_SIZE 16
+
+// Serves /stream outside the HTTP server task. The handler only admits the client and
+// hands its socket to an idle worker. The worker writes the multipart response straight
+// to the socket, paced by a token bucket per limit, while the server task is free for
+// the next request.
+class StreamSessions {
+  public:
+    // Start the workers, call once the server is running
+    static esp_err_t init(httpd_handle_t server);
+
+    // Take over the request's socket. ESP_ERR_NO_MEM when every session is busy,
+    // the caller still owns the request then and should answer it.
+    static esp_err_t admit(httpd_req_t *req, const stream_params_t &params);
+
+    // Same for a /frame long-poll: a worker waits for the frame and answers with it,
+    // or with a 504 once the timeout runs out. Shares the sessions with /stream.
+    static esp_err_t admit_frame(httpd_req_t *req, const frame_request_t &request);
+
+    // Same for a job, kind names it in /metrics. arg_len bytes of arg are copied for the
+    // worker, so the handler can return right away. Shares the sessions with /stream.
+    static esp_err_t admit_job(httpd_req_t *req, const char *kind, stream_job_t job,
+                               const void *arg, size_t arg_len);
+
+    // For jobs: send the 200 header with this content type, then body bytes. Both return
+    // false once the client is gone. job_count_frame adds a frame to the session's stats.
+    static bool job_begin(stream_session_t *session, const char *content_type);
+    static bool job_send(stream_session_t *session, const char *buf, size_t len);
+    static void job_count_frame(stream_session_t *session, size_t bytes);
+
+    // httpd close_fn: keeps workers from writing to a socket the server has closed
+    static void on_close(httpd_handle_t server, int fd);
+
+    // Write the "streams" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+
+  private:
+    static void run(void *arg);
+    static httpd_handle_t server;
+};
+
+#endif // STREAM_SESSIONS_H
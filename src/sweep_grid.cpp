@@ -0,0 +1,183 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sweep_grid.h"
+
+// decode %XX escapes in place, clients may encode the ':' ',' and '/' separators
+static void url_decode(char *s) {
+    char *out = s;
+    while (*s) {
+        if (s[0] == '%' && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2])) {
+            char hex[3] = { s[1], s[2], 0 };
+            *out++ = (char)strtol(hex, NULL, 16);
+            s += 3;
+        } else if (*s == '+') {
+            *out++ = ' ';
+            s++;
+        } else {
+            *out++ = *s++;
+        }
+    }
+    *out = 0;
+}
+
+static bool parse_int(const char *s, int *out) {
+    char *end;
+    long v = strtol(s, &end, 0);
+    if (end == s || *end || v < INT_MIN || v > INT_MAX) {
+        return false;
+    }
+    *out = (int)v;
+    return true;
+}
+
+// "a:b:c" range or "a,b,c" list
+static const char *parse_values(char *text, sweep_axis_t *axis) {
+    axis->count = 0;
+
+    if (strchr(text, ':')) {
+        char *first = text;
+        char *second = strchr(first, ':');
+        *second++ = 0;
+        char *third = strchr(second, ':');
+        int start, stop, step = 1;
+        if (third) {
+            *third++ = 0;
+            if (!parse_int(third, &step)) {
+                return "Invalid range step";
+            }
+        }
+        if (!parse_int(first, &start) || !parse_int(second, &stop)) {
+            return "Invalid range";
+        }
+        // in 64 bits, a range across the whole int span must not wrap
+        int64_t span = (int64_t)stop - start;
+        if (step == 0 || span / step < 0) {
+            return "Range step does not reach the end of the range";
+        }
+        int64_t count = span / step + 1;
+        if (count > SWEEP_MAX_VALUES) {
+            return "Too many values on one axis";
+        }
+        for (int i = 0; i < count; i++) {
+            axis->values[i] = (int)(start + (int64_t)i * step);
+        }
+        axis->count = (int)count;
+        return NULL;
+    }
+
+    char *save = NULL;
+    for (char *tok = strtok_r(text, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if (axis->count >= SWEEP_MAX_VALUES) {
+            return "Too many values on one axis";
+        }
+        if (!parse_int(tok, &axis->values[axis->count])) {
+            return "Invalid value";
+        }
+        axis->count++;
+    }
+    return axis->count ? NULL : "Axis has no values";
+}
+
+static const char *parse_axis_key(char *key, sweep_axis_t *axis) {
+    if (strlen(key) >= sizeof(axis->key)) {
+        return "Axis name too long";
+    }
+    strcpy(axis->key, key);
+
+    if (isdigit((unsigned char)key[0])) {
+        // raw register, optionally followed by /mask
+        axis->kind = SWEEP_AXIS_REGISTER;
+        axis->mask = 0xFF;
+        char *slash = strchr(key, '/');
+        if (slash) {
+            *slash++ = 0;
+            if (!parse_int(slash, &axis->mask)) {
+                return "Invalid register mask";
+            }
+        }
+        if (!parse_int(key, &axis->reg)) {
+            return "Invalid register";
+        }
+        return NULL;
+    }
+
+    axis->kind = SWEEP_AXIS_SETTING;
+    axis->reg = 0;
+    axis->mask = 0;
+    for (const char *c = key; *c; c++) {
+        if (!islower((unsigned char)*c) && !isdigit((unsigned char)*c) && *c != '_') {
+            return "Invalid setting name";
+        }
+    }
+    return NULL;
+}
+
+const char *sweep_grid_parse(const char *query, sweep_grid_t *grid) {
+    memset(grid, 0, sizeof(*grid));
+    grid->settle = SWEEP_DEFAULT_SETTLE;
+    grid->restore = true;
+
+    char buf[512];
+    if (!query || strlen(query) >= sizeof(buf)) {
+        return "Missing or oversized query";
+    }
+    strcpy(buf, query);
+
+    char *save = NULL;
+    for (char *pair = strtok_r(buf, "&", &save); pair; pair = strtok_r(NULL, "&", &save)) {
+        char *value = strchr(pair, '=');
+        if (!value) {
+            return "Parameter without a value";
+        }
+        *value++ = 0;
+        url_decode(pair);
+        url_decode(value);
+
+        if (!strcmp(pair, "settle")) {
+            if (!parse_int(value, &grid->settle) || grid->settle < 0 || grid->settle > SWEEP_MAX_SETTLE) {
+                return "settle must be 0-30";
+            }
+            continue;
+        }
+        if (!strcmp(pair, "restore")) {
+            grid->restore = strcmp(value, "0") != 0;
+            continue;
+        }
+
+        if (grid->axis_count >= SWEEP_MAX_AXES) {
+            return "Too many axes";
+        }
+        sweep_axis_t *axis = &grid->axes[grid->axis_count];
+        const char *err = parse_axis_key(pair, axis);
+        if (!err) {
+            err = parse_values(value, axis);
+        }
+        if (err) {
+            return err;
+        }
+        grid->axis_count++;
+    }
+
+    if (grid->axis_count == 0) {
+        return "No sweep axes given";
+    }
+
+    grid->points = 1;
+    for (int i = 0; i < grid->axis_count; i++) {
+        grid->points *= grid->axes[i].count;
+        if (grid->points > SWEEP_MAX_POINTS) {
+            return "Too many sweep points";
+        }
+    }
+    return NULL;
+}
+
+void sweep_grid_point(const sweep_grid_t *grid, uint32_t n, int *values) {
+    for (int i = grid->axis_count - 1; i >= 0; i--) {
+        const sweep_axis_t *axis = &grid->axes[i];
+        values[i] = axis->values[n % axis->count];
+        n /= axis->count;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef SWEEP_GRID_H
+#define SWEEP_GRID_H
+
+// Parameter grid for /sweep.
+//
+// The query string lists one axis per key, every other key is a sweep option:
+//   aec_value=0:1200:100     named /control setting, start:stop:step (stop included)
+//   agc_gain=0,5,10,20       named /control setting, explicit list
+//   0x3500=0,1,2             raw register, mask 0xFF
+//   0x3503/0x03=0,3          raw register with a mask
+//   settle=2                 frames to discard after applying each point
+//   restore=0                leave the last point applied instead of restoring the old values
+//
+// Points are enumerated with the last axis varying fastest. Plain C with no
+// Arduino dependency so it can be tested on the host.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SWEEP_MAX_AXES 4
+#define SWEEP_MAX_VALUES 64
+#define SWEEP_MAX_POINTS 1024
+#define SWEEP_MAX_SETTLE 30
+#define SWEEP_DEFAULT_SETTLE 2
+
+typedef enum {
+    SWEEP_AXIS_SETTING,  // named setting, applied through sensor_apply_setting
+    SWEEP_AXIS_REGISTER  // raw register, applied through sensor->set_reg
+} sweep_axis_kind_t;
+
+typedef struct {
+    sweep_axis_kind_t kind;
+    char key[24];   // setting name or register as written in the query
+    int reg;
+    int mask;
+    int values[SWEEP_MAX_VALUES];
+    int count;
+} sweep_axis_t;
+
+typedef struct {
+    sweep_axis_t axes[SWEEP_MAX_AXES];
+    int axis_count;
+    int settle;
+    bool restore;
+    uint32_t points;
+} sweep_grid_t;
+
+// Parse a URL query string. Returns NULL on success, otherwise a message for the client.
+const char *sweep_grid_parse(const char *query, sweep_grid_t *grid);
+
+// Fill values[axis] with the value every axis takes at point n
+void sweep_grid_point(const sweep_grid_t *grid, uint32_t n, int *values);
+
+#endif // SWEEP_GRID_H
@@ -0,0 +1,66 @@
+#ifndef TASK_CONFIG_H
+#define TASK_CONFIG_H
+
+// Where each task runs. All of these can be overridden from build_flags in platformio.ini.
+//
+// Core 0 (PRO_CPU) already hosts the Wi-Fi driver and the lwIP stack, so the
+// HTTP server stays next to them. Core 1 (APP_CPU) gets the camera capture
+// task and every CPU heavy stage that works on pixels.
+
+#ifndef NET_CORE
+#define NET_CORE 0
+#endif
+
+#ifndef CAPTURE_CORE
+#define CAPTURE_CORE 1
+#endif
+
+// Above the Arduino loopTask (1), well below the Wi-Fi task (23)
+#ifndef CAPTURE_TASK_PRIORITY
+#define CAPTURE_TASK_PRIORITY 6
+#endif
+
+// Sensor commands run on the capture task too, /status and /regdump format their output there
+#ifndef CAPTURE_TASK_STACK
+#define CAPTURE_TASK_STACK 6144
+#endif
+
+#ifndef HTTPD_TASK_PRIORITY
+#define HTTPD_TASK_PRIORITY 5
+#endif
+
+// TLS handshakes run on the server task, the key exchange needs the extra room
+#ifndef HTTPD_TASK_STACK
+#if WEB_SERVER_TLS
+#define HTTPD_TASK_STACK 10240
+#else
+#define HTTPD_TASK_STACK 8192
+#endif
+#endif
+
+// /stream workers sit below the HTTP server task, so control endpoints always get
+// served first and a busy stream only ever uses the time left over
+#ifndef STREAM_TASK_PRIORITY
+#define STREAM_TASK_PRIORITY (HTTPD_TASK_PRIORITY - 1)
+#endif
+
+// over TLS every send encrypts a record on the worker's stack
+#ifndef STREAM_TASK_STACK
+#if WEB_SERVER_TLS
+#define STREAM_TASK_STACK 6144
+#else
+#define STREAM_TASK_STACK 4096
+#endif
+#endif
+
+// The time-lapse task mostly sleeps, when it runs it waits on frames and the upload
+#ifndef TIMELAPSE_TASK_PRIORITY
+#define TIMELAPSE_TASK_PRIORITY (HTTPD_TASK_PRIORITY - 1)
+#endif
+
+// esp_http_client needs the room for the upload
+#ifndef TIMELAPSE_TASK_STACK
+#define TIMELAPSE_TASK_STACK 6144
+#endif
+
+#endif // TASK_CONFIG_H
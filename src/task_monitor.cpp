@@ -0,0 +1,254 @@
+#include <Arduino.h>
+#include <string.h>
+#include "task_monitor.h"
+
+// enough for the tasks the Arduino core, Wi-Fi, lwIP and our own code create
+#define TASK_MONITOR_MAX_TASKS 32
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+
+// run time counters from the previous call, to turn totals into a recent percentage
+static struct {
+    TaskHandle_t handle;
+    uint32_t runtime;
+} previous[TASK_MONITOR_MAX_TASKS];
+static int previous_count = 0;
+static uint32_t previous_total = 0;
+
+static uint32_t previous_runtime(TaskHandle_t handle) {
+    for (int i = 0; i < previous_count; i++) {
+        if (previous[i].handle == handle) {
+            return previous[i].runtime;
+        }
+    }
+    return 0;
+}
+
+//public
+
+// the task list already has every task and FreeRTOS keeps the counters
+esp_err_t TaskMonitor::init() {
+    return ESP_OK;
+}
+
+void TaskMonitor::watch(TaskHandle_t task) {
+    (void)task;
+}
+
+int TaskMonitor::write_metrics(char *out, size_t len) {
+    static TaskStatus_t tasks[TASK_MONITOR_MAX_TASKS];
+    uint32_t total = 0;
+
+    UBaseType_t count = uxTaskGetSystemState(tasks, TASK_MONITOR_MAX_TASKS, &total);
+
+    // the total counts once per core, scale so a task pegging one core reads 100%
+    uint32_t elapsed = (total - previous_total) / portNUM_PROCESSORS;
+
+    size_t n = 0;
+    n += snprintf(out + n, len - n, "\"tasks\":[");
+    for (UBaseType_t i = 0; i < count && n < len; i++) {
+        TaskStatus_t *t = &tasks[i];
+        uint32_t delta = t->ulRunTimeCounter - previous_runtime(t->xHandle);
+        unsigned cpu = elapsed ? (unsigned)((uint64_t)delta * 100 / elapsed) : 0;
+
+#if configTASKLIST_INCLUDE_COREID
+        // xCoreID is tskNO_AFFINITY for tasks that may run on either core
+        int core = t->xCoreID == tskNO_AFFINITY ? -1 : (int)t->xCoreID;
+#else
+        int core = -1;
+#endif
+
+        n += snprintf(out + n, len - n,
+            "%s{\"name\":\"%s\",\"core\":%d,\"prio\":%u,\"cpu\":%u,\"stack_free\":%u}",
+            i ? "," : "", t->pcTaskName, core, (unsigned)t->uxCurrentPriority, cpu,
+            (unsigned)t->usStackHighWaterMark);
+    }
+    if (n < len) {
+        n += snprintf(out + n, len - n, "]");
+    }
+
+    previous_count = count;
+    for (UBaseType_t i = 0; i < count; i++) {
+        previous[i].handle = tasks[i].xHandle;
+        previous[i].runtime = tasks[i].ulRunTimeCounter;
+    }
+    previous_total = total;
+
+    return n < len ? (int)n : (int)(len ? len - 1 : 0);
+}
+
+#else
+
+#include <esp_freertos_hooks.h>
+
+// Without the run time counters (the stock Arduino SDK), each core's tick interrupt
+// charges the tick to whichever task it interrupted. At 1 kHz that is plenty to tell
+// a busy task from an idle one. The hook runs with the flash cache possibly off, so
+// it only walks a fixed table of handles in DRAM and never adds to it.
+
+typedef struct {
+    TaskHandle_t handle;
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t ticks;      // ticks this task was running at, on any core
+    uint32_t previous;   // ticks at the previous report
+    int8_t core;         // core it was last seen on, -1 before that
+} sampled_task_t;
+
+static portMUX_TYPE table_lock = portMUX_INITIALIZER_UNLOCKED;
+static sampled_task_t tasks[TASK_MONITOR_MAX_TASKS];
+static volatile int task_count = 0;
+
+static TaskHandle_t idle[portNUM_PROCESSORS];
+static uint32_t ticks[portNUM_PROCESSORS];
+static uint32_t idle_ticks[portNUM_PROCESSORS];
+static uint32_t other_ticks[portNUM_PROCESSORS];   // tasks that are not in the table
+static uint32_t previous_ticks[portNUM_PROCESSORS];
+static uint32_t previous_idle[portNUM_PROCESSORS];
+static uint32_t previous_other[portNUM_PROCESSORS];
+
+// system tasks worth watching, picked up by name once they exist
+static const char *system_tasks[] = { "httpd", "loopTask", "wifi", "tiT", "sys_evt" };
+static bool system_found[sizeof(system_tasks) / sizeof(system_tasks[0])];
+
+static void IRAM_ATTR sample(int core) {
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+
+    portENTER_CRITICAL_ISR(&table_lock);
+    ticks[core]++;
+    if (current == idle[core]) {
+        idle_ticks[core]++;
+    } else {
+        int i = 0;
+        while (i < task_count && tasks[i].handle != current) {
+            i++;
+        }
+        if (i < task_count) {
+            tasks[i].ticks++;
+            tasks[i].core = core;
+        } else {
+            other_ticks[core]++;
+        }
+    }
+    portEXIT_CRITICAL_ISR(&table_lock);
+}
+
+static void IRAM_ATTR sample_core0() {
+    sample(0);
+}
+
+#if portNUM_PROCESSORS > 1
+static void IRAM_ATTR sample_core1() {
+    sample(1);
+}
+#endif
+
+static void watch_system_tasks() {
+    for (size_t i = 0; i < sizeof(system_tasks) / sizeof(system_tasks[0]); i++) {
+        if (system_found[i]) {
+            continue;
+        }
+        TaskHandle_t handle = xTaskGetHandle(system_tasks[i]);
+        if (handle) {
+            system_found[i] = true;
+            TaskMonitor::watch(handle);
+        }
+    }
+}
+
+//public
+
+esp_err_t TaskMonitor::init() {
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        idle[core] = xTaskGetIdleTaskHandleForCPU(core);
+    }
+    esp_err_t err = esp_register_freertos_tick_hook_for_cpu(sample_core0, 0);
+#if portNUM_PROCESSORS > 1
+    if (err == ESP_OK) {
+        err = esp_register_freertos_tick_hook_for_cpu(sample_core1, 1);
+    }
+#endif
+    return err;
+}
+
+void TaskMonitor::watch(TaskHandle_t task) {
+    if (!task) {
+        return;
+    }
+    // name copied here, where reading it is safe, the hook only compares handles
+    sampled_task_t entry = {};
+    entry.handle = task;
+    strncpy(entry.name, pcTaskGetName(task), sizeof(entry.name) - 1);
+    entry.core = -1;
+
+    portENTER_CRITICAL(&table_lock);
+    bool known = false;
+    for (int i = 0; i < task_count; i++) {
+        known |= tasks[i].handle == task;
+    }
+    if (!known && task_count < TASK_MONITOR_MAX_TASKS) {
+        tasks[task_count] = entry;
+        task_count++;
+    }
+    portEXIT_CRITICAL(&table_lock);
+}
+
+int TaskMonitor::write_metrics(char *out, size_t len) {
+    watch_system_tasks();
+
+    static sampled_task_t snapshot[TASK_MONITOR_MAX_TASKS];
+    uint32_t core_ticks[portNUM_PROCESSORS], core_idle[portNUM_PROCESSORS], core_other[portNUM_PROCESSORS];
+    int count;
+
+    portENTER_CRITICAL(&table_lock);
+    count = task_count;
+    memcpy(snapshot, tasks, count * sizeof(sampled_task_t));
+    for (int i = 0; i < count; i++) {
+        tasks[i].previous = tasks[i].ticks;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        core_ticks[core] = ticks[core] - previous_ticks[core];
+        core_idle[core] = idle_ticks[core] - previous_idle[core];
+        core_other[core] = other_ticks[core] - previous_other[core];
+        previous_ticks[core] = ticks[core];
+        previous_idle[core] = idle_ticks[core];
+        previous_other[core] = other_ticks[core];
+    }
+    portEXIT_CRITICAL(&table_lock);
+
+    // both cores tick at the same rate, one core's worth of ticks is 100%
+    uint32_t elapsed = core_ticks[0];
+
+    size_t n = 0;
+    n += snprintf(out + n, len - n, "\"cores\":[");
+    for (int core = 0; core < portNUM_PROCESSORS && n < len; core++) {
+        uint32_t t = core_ticks[core];
+        n += snprintf(out + n, len - n, "%s{\"core\":%d,\"load\":%u,\"other\":%u}", core ? "," : "", core,
+            t ? (unsigned)((uint64_t)(t - core_idle[core]) * 100 / t) : 0,
+            t ? (unsigned)((uint64_t)core_other[core] * 100 / t) : 0);
+    }
+    if (n < len) {
+        n += snprintf(out + n, len - n, "],\"tasks\":[");
+    }
+    for (int i = 0; i < count && n < len; i++) {
+        sampled_task_t *t = &snapshot[i];
+        unsigned cpu = elapsed ? (unsigned)((uint64_t)(t->ticks - t->previous) * 100 / elapsed) : 0;
+
+        // a watched task may have been deleted since, only trust the handle while the name still leads to it
+        TaskHandle_t live = xTaskGetHandle(t->name);
+        if (live != t->handle) {
+            n += snprintf(out + n, len - n, "%s{\"name\":\"%s\",\"core\":%d,\"cpu\":%u,\"gone\":true}",
+                i ? "," : "", t->name, t->core, cpu);
+            continue;
+        }
+        n += snprintf(out + n, len - n,
+            "%s{\"name\":\"%s\",\"core\":%d,\"prio\":%u,\"cpu\":%u,\"stack_free\":%u}",
+            i ? "," : "", t->name, t->core, (unsigned)uxTaskPriorityGet(live), cpu,
+            (unsigned)uxTaskGetStackHighWaterMark(live));
+    }
+    if (n < len) {
+        n += snprintf(out + n, len - n, "]");
+    }
+    return n < len ? (int)n : (int)(len ? len - 1 : 0);
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef TASK_MONITOR_H
+#define TASK_MONITOR_H
+
+#include <stddef.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Per task CPU utilisation, core affinity and stack high-water marks
+class TaskMonitor {
+  public:
+    // Start sampling, call before the tasks that should be measured are created
+    static esp_err_t init();
+
+    // Add a task to the report. With the FreeRTOS run time counters every task is
+    // listed anyway, without them only watched tasks and a few system ones are.
+    static void watch(TaskHandle_t task);
+
+    // Write the "tasks" member of the /metrics JSON object.
+    // CPU percentages cover the time since the previous call.
+    static int write_metrics(char *out, size_t len);
+};
+
+#endif // TASK_MONITOR_H
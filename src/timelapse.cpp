@@ -0,0 +1,400 @@
+#include <string.h>
+#include <mutex>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_heap_caps.h>
+#include <esp_http_client.h>
+#if TIMELAPSE_LIGHT_SLEEP
+#include <esp_pm.h>
+#endif
+#include "timelapse.h"
+#include "timelapse_schedule.h"
+#include "capture_task.h"
+#include "camera_hal.h"
+#include "sensor_queue.h"
+#include "task_config.h"
+#include "task_monitor.h"
+
+TaskHandle_t TimeLapse::task = NULL;
+
+// how long a shot waits for each frame before giving up on it
+#define TIMELAPSE_FRAME_TIMEOUT_MS 3000
+// frames from before the wake still sitting in the driver buffers, on top of the warm-up
+#define TIMELAPSE_MAX_STALE_FRAMES 4
+
+// The driver has no standby call, these sensors have a bit for it
+static const struct {
+    uint16_t pid;
+    int reg;
+    int mask;
+} standby_regs[] = {
+    { OV2640_PID, 0x109, 0x10 },  // COM2 in the sensor bank, bit 4 standby
+    { OV3660_PID, 0x3008, 0x40 }, // SYSTEM CTROL0, bit 6 software power down
+    { OV5640_PID, 0x3008, 0x40 },
+};
+
+typedef struct {
+    uint32_t failed;          // no frame after waking
+    uint32_t stale_dropped;   // captured before the wake
+    uint32_t warmup_dropped;
+    uint32_t not_stored;      // no PSRAM for the copy
+    uint32_t wake_first_us;   // wake until the first fresh frame started, last shot
+    uint32_t wake_shot_us;    // wake until the kept frame started, last shot
+    uint32_t wake_shot_max_us;
+    uint64_t wake_shot_sum_us;
+    uint32_t wake_shots;      // shots in wake_shot_sum_us, the schedule's count starts over on a restart
+    uint32_t uploads;
+    uint32_t upload_failures;
+    int upload_status;        // HTTP status of the last upload, -1 if it did not get that far
+    uint32_t upload_ms;
+} timelapse_stats_t;
+
+// A kept shot and its JPEG in one PSRAM block, freed when the last reference goes.
+// shots holds one reference, acquire_shot hands out more.
+typedef struct {
+    timelapse_shot_t shot;  // first, so a shot pointer is also a stored_shot_t pointer
+    int refs;
+} stored_shot_t;
+
+// guards everything below, the reference counts of the shots too
+static std::mutex state_lock;
+static bool running = false;
+static timelapse_params_t params = {};
+static timelapse_schedule_t schedule = {};
+static uint32_t schedule_starts = 0;  // a shot that outlives a restart leaves the new schedule alone
+static timelapse_stats_t stats = {};
+static bool standby_supported = false;
+static stored_shot_t *shots[TIMELAPSE_KEEP_SHOTS] = {};
+static int newest_shot = -1;
+
+static int64_t frame_time_us(const frame_t *frame) {
+    return (int64_t)frame->timestamp.tv_sec * 1000000LL + frame->timestamp.tv_usec;
+}
+
+static bool set_standby(bool on) {
+    sensor_t *sensor = CameraHal::get_sensor();
+    if (!sensor) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(standby_regs) / sizeof(standby_regs[0]); i++) {
+        if (standby_regs[i].pid == sensor->id.PID) {
+            sensor_result_t result;
+            int mask = standby_regs[i].mask;
+            return SensorQueue::write_reg(standby_regs[i].reg, mask, on ? mask : 0, &result) == ESP_OK && result.res == 0;
+        }
+    }
+    return false;
+}
+
+// drop a reference, called with state_lock held
+static void unref_shot(stored_shot_t *stored) {
+    if (stored && --stored->refs == 0) {
+        heap_caps_free(stored);
+    }
+}
+
+static void store_shot(const frame_t *frame, uint32_t wake_us) {
+    // copied outside the lock, so /timelapse?shot=N never waits for it
+    stored_shot_t *stored = (stored_shot_t *)heap_caps_malloc(sizeof(stored_shot_t) + frame->len, MALLOC_CAP_SPIRAM);
+    if (stored) {
+        stored->shot.buf = (uint8_t *)(stored + 1);
+        memcpy(stored->shot.buf, frame->buf, frame->len);
+        stored->shot.len = frame->len;
+        stored->shot.seq = frame->seq;
+        stored->shot.wall = frame->wall;
+        stored->shot.wake_us = wake_us;
+        stored->refs = 1;
+    }
+
+    std::lock_guard<std::mutex> guard(state_lock);
+    if (!stored) {
+        stats.not_stored++;
+        return;
+    }
+    newest_shot = (newest_shot + 1) % TIMELAPSE_KEEP_SHOTS;
+    unref_shot(shots[newest_shot]);
+    shots[newest_shot] = stored;
+}
+
+static void upload_shot(const char *url, const frame_t *frame) {
+    int64_t start = esp_timer_get_time();
+    // sending in modem sleep waits for beacons on every ACK, stay awake just for the upload
+    esp_wifi_set_ps(WIFI_PS_NONE);
+
+    esp_http_client_config_t config = {};
+    config.url = url;
+    config.method = HTTP_METHOD_POST;
+    config.timeout_ms = TIMELAPSE_UPLOAD_TIMEOUT_MS;
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+
+    int status = -1;
+    if (client) {
+        char header[32];
+        esp_http_client_set_header(client, "Content-Type", "image/jpeg");
+        snprintf(header, sizeof(header), "%lld.%06ld", (long long)frame->wall.tv_sec, (long)frame->wall.tv_usec);
+        esp_http_client_set_header(client, "X-Timestamp", header);
+        snprintf(header, sizeof(header), "%u", frame->seq);
+        esp_http_client_set_header(client, "X-Sequence", header);
+        esp_http_client_set_post_field(client, (const char *)frame->buf, frame->len);
+        if (esp_http_client_perform(client) == ESP_OK) {
+            status = esp_http_client_get_status_code(client);
+        }
+        esp_http_client_cleanup(client);
+    }
+
+    esp_wifi_set_ps(TIMELAPSE_WIFI_PS);
+
+    std::lock_guard<std::mutex> guard(state_lock);
+    stats.upload_status = status;
+    stats.upload_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+    if (status >= 200 && status < 300) {
+        stats.uploads++;
+    } else {
+        stats.upload_failures++;
+        Serial.printf("Time-lapse upload of frame %u failed, status %d\n", frame->seq, status);
+    }
+}
+
+//public
+
+esp_err_t TimeLapse::start(const timelapse_params_t &new_params) {
+    if (new_params.interval_s < TIMELAPSE_MIN_INTERVAL_S) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!task) {
+        BaseType_t res = xTaskCreatePinnedToCore(run, "timelapse", TIMELAPSE_TASK_STACK, NULL,
+                                                 TIMELAPSE_TASK_PRIORITY, &task, NET_CORE);
+        if (res != pdPASS) {
+            return ESP_FAIL;
+        }
+        TaskMonitor::watch(task);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        params = new_params;
+        timelapse_schedule_init(&schedule, (int64_t)params.interval_s * 1000000LL, esp_timer_get_time());
+        schedule_starts++;
+        running = true;
+    }
+    Serial.printf("Time-lapse every %u s, %u warm-up frames%s%s\n", new_params.interval_s,
+        new_params.warmup_frames, new_params.upload_url[0] ? ", upload to " : "", new_params.upload_url);
+    xTaskNotifyGive(task);
+    return ESP_OK;
+}
+
+void TimeLapse::stop() {
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        running = false;
+    }
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+const timelapse_shot_t *TimeLapse::acquire_shot(int index) {
+    if (index < 0 || index >= TIMELAPSE_KEEP_SHOTS) {
+        return NULL;
+    }
+    std::lock_guard<std::mutex> guard(state_lock);
+    if (newest_shot < 0) {
+        return NULL;
+    }
+    stored_shot_t *stored = shots[(newest_shot - index + TIMELAPSE_KEEP_SHOTS) % TIMELAPSE_KEEP_SHOTS];
+    if (!stored) {
+        return NULL;
+    }
+    stored->refs++;
+    return &stored->shot;
+}
+
+void TimeLapse::release_shot(const timelapse_shot_t *shot) {
+    std::lock_guard<std::mutex> guard(state_lock);
+    unref_shot((stored_shot_t *)shot);
+}
+
+int TimeLapse::write_metrics(char *out, size_t len) {
+    std::lock_guard<std::mutex> guard(state_lock);
+
+    int stored = 0;
+    for (int i = 0; i < TIMELAPSE_KEEP_SHOTS; i++) {
+        stored += shots[i] != NULL;
+    }
+    int64_t next_in_ms = running ? timelapse_schedule_sleep_us(&schedule, esp_timer_get_time()) / 1000 : -1;
+    uint32_t wake_avg_us = stats.wake_shots ? (uint32_t)(stats.wake_shot_sum_us / stats.wake_shots) : 0;
+
+    return snprintf(out, len,
+        "\"timelapse\":{\"running\":%s,\"interval_s\":%u,\"warmup\":%u,\"standby\":%s,\"light_sleep\":%s,"
+        "\"shots\":%u,\"skipped\":%u,\"failed\":%u,\"stored\":%d,\"not_stored\":%u,"
+        "\"stale_dropped\":%u,\"warmup_dropped\":%u,\"lead_ms\":%lld,\"next_wake_in_ms\":%lld,"
+        "\"wake_to_first_us\":%u,\"wake_to_shot_us\":{\"last\":%u,\"avg\":%u,\"max\":%u},"
+        "\"upload\":{\"url\":\"%s\",\"ok\":%u,\"failed\":%u,\"last_status\":%d,\"last_ms\":%u}}",
+        running ? "true" : "false", params.interval_s, params.warmup_frames,
+        standby_supported ? "true" : "false", TIMELAPSE_LIGHT_SLEEP ? "true" : "false",
+        schedule.shots, schedule.skipped, stats.failed, stored, stats.not_stored,
+        stats.stale_dropped, stats.warmup_dropped, (long long)(schedule.lead_us / 1000), (long long)next_in_ms,
+        stats.wake_first_us, stats.wake_shot_us, wake_avg_us, stats.wake_shot_max_us,
+        params.upload_url, stats.uploads, stats.upload_failures, stats.upload_status, stats.upload_ms);
+}
+
+//private
+
+void TimeLapse::run(void *arg) {
+    // whether we hold a capture pause and the sensor and radio are in their sleep modes
+    bool armed = false;
+
+    while (true) {
+        bool want;
+        int64_t sleep_us;
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            want = running;
+            sleep_us = timelapse_schedule_sleep_us(&schedule, esp_timer_get_time());
+        }
+
+        if (want != armed) {
+            if (want) {
+                enter();
+            } else {
+                leave();
+            }
+            armed = want;
+        }
+
+        if (!want) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        } else if (sleep_us > 0) {
+            // start and stop notify us, so a change does not wait for the next shot
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((sleep_us + 999) / 1000));
+        } else {
+            shoot();
+        }
+    }
+}
+
+void TimeLapse::enter() {
+    CaptureTask::pause();
+    bool supported = set_standby(true);
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        standby_supported = supported;
+    }
+    if (!supported) {
+        Serial.println("Time-lapse: no standby for this sensor, it keeps running between shots");
+    }
+
+    esp_wifi_set_ps(TIMELAPSE_WIFI_PS);
+#if TIMELAPSE_LIGHT_SLEEP
+    esp_pm_config_esp32s3_t pm = {};
+    pm.max_freq_mhz = CONFIG_ESP32S3_DEFAULT_CPU_FREQ_MHZ;
+    pm.min_freq_mhz = 40;
+    pm.light_sleep_enable = true;
+    if (esp_pm_configure(&pm) != ESP_OK) {
+        Serial.println("Time-lapse: light sleep not available, modem sleep only");
+    }
+#endif
+}
+
+void TimeLapse::leave() {
+#if TIMELAPSE_LIGHT_SLEEP
+    esp_pm_config_esp32s3_t pm = {};
+    pm.max_freq_mhz = CONFIG_ESP32S3_DEFAULT_CPU_FREQ_MHZ;
+    pm.min_freq_mhz = CONFIG_ESP32S3_DEFAULT_CPU_FREQ_MHZ;
+    pm.light_sleep_enable = false;
+    esp_pm_configure(&pm);
+#endif
+    // back to how main set things up
+    esp_wifi_set_ps(WIFI_PS_NONE);
+    set_standby(false);
+    CaptureTask::resume();
+    Serial.println("Time-lapse stopped");
+}
+
+void TimeLapse::shoot() {
+    uint32_t warmup;
+    char url[TIMELAPSE_URL_MAX];
+    uint32_t starts;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        warmup = params.warmup_frames;
+        strcpy(url, params.upload_url);
+        starts = schedule_starts;
+    }
+
+    int64_t wake_us = esp_timer_get_time();
+    set_standby(false);
+    CaptureTask::resume();
+
+    // Frames captured before the wake may still wait in the driver buffers, those go
+    // by their VSYNC time. After them come the warm-up frames, the one after is kept.
+    uint32_t seq = CaptureTask::latest_seq();
+    uint32_t stale = 0;
+    uint32_t fresh = 0;
+    int64_t first_us = 0;
+    frame_t *frame = NULL;
+    while ((frame = CaptureTask::acquire_next(seq, TIMELAPSE_FRAME_TIMEOUT_MS)) != NULL) {
+        seq = frame->seq;
+        if (frame_time_us(frame) < wake_us) {
+            CaptureTask::release(frame);
+            frame = NULL;
+            if (++stale > TIMELAPSE_MAX_STALE_FRAMES) {
+                break;
+            }
+            continue;
+        }
+        if (fresh++ == 0) {
+            first_us = frame_time_us(frame);
+        }
+        if (fresh > warmup) {
+            break;
+        }
+        CaptureTask::release(frame);
+        frame = NULL;
+    }
+
+    // the shot is in hand, the sensor can go straight back to sleep
+    CaptureTask::pause();
+    set_standby(true);
+
+    int64_t now = esp_timer_get_time();
+    int64_t frame_us = frame ? frame_time_us(frame) : now;
+    uint32_t wake_shot_us = (uint32_t)(frame_us - wake_us);
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stats.stale_dropped += stale;
+        stats.warmup_dropped += fresh > warmup ? warmup : fresh;
+        if (frame) {
+            stats.wake_first_us = (uint32_t)(first_us - wake_us);
+            stats.wake_shot_us = wake_shot_us;
+            stats.wake_shot_sum_us += wake_shot_us;
+            stats.wake_shots++;
+            if (wake_shot_us > stats.wake_shot_max_us) {
+                stats.wake_shot_max_us = wake_shot_us;
+            }
+        } else {
+            stats.failed++;
+            // a failed shot does not tell us anything about the wake latency
+            if (starts == schedule_starts) {
+                timelapse_schedule_done(&schedule, wake_us, wake_us + schedule.lead_us, now);
+            }
+        }
+    }
+
+    if (!frame) {
+        Serial.println("Time-lapse: no frame after waking the sensor");
+        return;
+    }
+
+    store_shot(frame, wake_shot_us);
+    if (url[0]) {
+        upload_shot(url, frame);
+    }
+    CaptureTask::release(frame);
+
+    // only now the shot is over, an upload that runs into the next due time skips it
+    std::lock_guard<std::mutex> guard(state_lock);
+    if (starts == schedule_starts) {
+        timelapse_schedule_done(&schedule, wake_us, frame_us, esp_timer_get_time());
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef TIMELAPSE_H
+#define TIMELAPSE_H
+
+#include <Arduino.h>
+#include <esp_err.h>
+#include <sys/time.h>
+
+// Frames the sensor delivers after waking that are thrown away before the shot,
+// auto exposure and white balance need a few to settle
+#ifndef TIMELAPSE_WARMUP_FRAMES
+#define TIMELAPSE_WARMUP_FRAMES 2
+#endif
+
+// Most warm-up frames /timelapse takes, each one keeps the sensor awake for a frame time
+#ifndef TIMELAPSE_MAX_WARMUP_FRAMES
+#define TIMELAPSE_MAX_WARMUP_FRAMES 30
+#endif
+
+#ifndef TIMELAPSE_MIN_INTERVAL_S
+#define TIMELAPSE_MIN_INTERVAL_S 5
+#endif
+
+// Latest shots kept in PSRAM for /timelapse?shot=N
+#ifndef TIMELAPSE_KEEP_SHOTS
+#define TIMELAPSE_KEEP_SHOTS 4
+#endif
+
+#ifndef TIMELAPSE_UPLOAD_TIMEOUT_MS
+#define TIMELAPSE_UPLOAD_TIMEOUT_MS 10000
+#endif
+
+// Power save mode of the radio between shots, WIFI_PS_MIN_MODEM wakes for every DTIM beacon
+#ifndef TIMELAPSE_WIFI_PS
+#define TIMELAPSE_WIFI_PS WIFI_PS_MAX_MODEM
+#endif
+
+// Let the CPU drop into automatic light sleep between shots. Needs CONFIG_PM_ENABLE
+// in the SDK, and requests to the camera are only answered once the radio wakes up.
+#ifndef TIMELAPSE_LIGHT_SLEEP
+#define TIMELAPSE_LIGHT_SLEEP 0
+#endif
+
+#define TIMELAPSE_URL_MAX 128
+
+typedef struct {
+    uint32_t interval_s;
+    uint32_t warmup_frames;
+    char upload_url[TIMELAPSE_URL_MAX]; // POST every shot here as image/jpeg, empty to only keep it
+} timelapse_params_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    uint32_t seq;
+    struct timeval wall;
+    uint32_t wake_us;  // from waking the sensor until this frame started
+} timelapse_shot_t;
+
+// Duty-cycled capture for units on battery: one frame every interval, with the sensor
+// in software standby and the capture task paused in between, and the radio in modem
+// sleep. For a shot the task wakes the sensor, drops every frame captured before the
+// wake plus the warm-up frames, keeps the next one, puts the sensor back to sleep and
+// then uploads the shot. The driver and its clock stay up, so waking only costs the
+// sensor's standby exit and the warm-up frames. The schedule wakes that much ahead of
+// time, see timelapse_schedule.h.
+//
+// While it runs, /stream and /snapshot only see frames during shots.
+class TimeLapse {
+  public:
+    // Start, or restart with new parameters. The first shot is taken right away.
+    static esp_err_t start(const timelapse_params_t &params);
+    static void stop();
+
+    // The index-th most recent shot, 0 is the latest. NULL when there is none, otherwise
+    // call release_shot once done with it. The shot stays valid until then even if newer
+    // shots replace it, without holding up the time-lapse task.
+    static const timelapse_shot_t *acquire_shot(int index);
+    static void release_shot(const timelapse_shot_t *shot);
+
+    // Write the "timelapse" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+
+  private:
+    static void run(void *arg);
+    static void enter();
+    static void leave();
+    static void shoot();
+
+    static TaskHandle_t task;
+};
+
+#endif // TIMELAPSE_H
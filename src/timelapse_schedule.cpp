@@ -0,0 +1,35 @@
+#include "timelapse_schedule.h"
+
+void timelapse_schedule_init(timelapse_schedule_t *s, int64_t interval_us, int64_t now_us) {
+    s->interval_us = interval_us > 0 ? interval_us : 1;
+    s->next_us = now_us;
+    s->lead_us = 0;
+    s->shots = 0;
+    s->skipped = 0;
+}
+
+int64_t timelapse_schedule_sleep_us(const timelapse_schedule_t *s, int64_t now_us) {
+    int64_t wake_us = s->next_us - s->lead_us;
+    return wake_us > now_us ? wake_us - now_us : 0;
+}
+
+void timelapse_schedule_done(timelapse_schedule_t *s, int64_t wake_us, int64_t frame_us, int64_t now_us) {
+    s->shots++;
+
+    int64_t latency = frame_us > wake_us ? frame_us - wake_us : 0;
+    if (latency > s->lead_us) {
+        s->lead_us = latency;
+    } else {
+        s->lead_us -= (s->lead_us - latency) / 4;
+    }
+    // waking earlier than half an interval would mean never sleeping at all
+    if (s->lead_us > s->interval_us / 2) {
+        s->lead_us = s->interval_us / 2;
+    }
+
+    s->next_us += s->interval_us;
+    while (s->next_us <= now_us) {
+        s->next_us += s->interval_us;
+        s->skipped++;
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef TIMELAPSE_SCHEDULE_H
+#define TIMELAPSE_SCHEDULE_H
+
+// When to wake up for the next time-lapse shot.
+//
+// Shots are due on a fixed grid, start + k * interval, so they never drift no matter
+// how long each one takes. The camera needs time from waking up until the frame we
+// keep is captured, so the schedule wakes lead_us before a shot is due. lead_us follows
+// the measured wake-to-frame latency: it jumps up to a slower wake straight away, so the
+// next shot is not late again, and creeps back down when waking gets faster.
+// A shot that runs past the following due time skips that slot rather than rushing it.
+//
+// Time is passed in by the caller, so this has no Arduino dependency and can be
+// tested on the host with a simulated clock.
+
+#include <stdint.h>
+
+typedef struct {
+    int64_t interval_us;
+    int64_t next_us;   // when the next kept frame is due
+    int64_t lead_us;   // wake up this much before next_us
+    uint32_t shots;
+    uint32_t skipped;  // due times that went by while a shot was still running
+} timelapse_schedule_t;
+
+// The first shot is due right away
+void timelapse_schedule_init(timelapse_schedule_t *s, int64_t interval_us, int64_t now_us);
+
+// Microseconds to sleep before waking for the next shot, 0 when it is time already
+int64_t timelapse_schedule_sleep_us(const timelapse_schedule_t *s, int64_t now_us);
+
+// A shot is done: woken at wake_us, the kept frame was captured at frame_us.
+// Moves on to the next due time after now_us.
+void timelapse_schedule_done(timelapse_schedule_t *s, int64_t wake_us, int64_t frame_us, int64_t now_us);
+
+#endif // TIMELAPSE_SCHEDULE_H
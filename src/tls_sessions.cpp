@@ -0,0 +1,232 @@
+#include <string.h>
+#include <time.h>
+#include <mutex>
+#include <esp_timer.h>
+#include <esp_tls.h>
+#include <esp_https_server.h>
+#include "tls_sessions.h"
+#if WEB_SERVER_TLS
+#include "tls_cert.h"
+#endif
+
+bool TlsSessions::started = false;
+static bool tickets = false;
+
+typedef struct {
+    uint32_t full;
+    uint32_t resumed;
+    uint32_t failed;
+    int64_t full_us;       // summed over all full handshakes
+    int64_t resumed_us;
+    uint32_t max_us;
+    uint32_t frames;
+    uint64_t frame_bytes;
+    int64_t crypto_us;     // summed over all frames
+    uint32_t max_frame_crypto_us;
+    const char *suite;     // of the latest handshake
+    const char *version;
+} tls_stats_t;
+
+static std::mutex stats_lock;
+static tls_stats_t stats = {};
+
+// time the current task spent inside the socket send below mbedTLS
+static thread_local int64_t socket_us = 0;
+
+#if WEB_SERVER_TLS
+static int (*net_send)(void *ctx, const unsigned char *buf, size_t len) = NULL;
+
+// one per open session, see the class comment
+typedef struct {
+    esp_tls_t *tls;
+    ssize_t (*read)(esp_tls_t *tls, char *data, size_t len);
+    ssize_t (*write)(esp_tls_t *tls, const char *data, size_t len);
+    std::mutex lock;
+} session_lock_t;
+
+static std::mutex session_locks_lock;
+static session_lock_t session_locks[WEB_SERVER_TLS_MAX_SOCKETS];
+
+static session_lock_t *find_session_lock(esp_tls_t *tls) {
+    std::lock_guard<std::mutex> guard(session_locks_lock);
+    for (int i = 0; i < WEB_SERVER_TLS_MAX_SOCKETS; i++) {
+        if (session_locks[i].tls == tls) {
+            return &session_locks[i];
+        }
+    }
+    return NULL;
+}
+
+static ssize_t locked_read(esp_tls_t *tls, char *data, size_t len) {
+    session_lock_t *s = find_session_lock(tls);
+    std::lock_guard<std::mutex> guard(s->lock);
+    return s->read(tls, data, len);
+}
+
+static ssize_t locked_write(esp_tls_t *tls, const char *data, size_t len) {
+    session_lock_t *s = find_session_lock(tls);
+    std::lock_guard<std::mutex> guard(s->lock);
+    return s->write(tls, data, len);
+}
+
+static int timed_send(void *ctx, const unsigned char *buf, size_t len) {
+    int64_t start = esp_timer_get_time();
+    int res = net_send(ctx, buf, len);
+    socket_us += esp_timer_get_time() - start;
+    return res;
+}
+
+extern "C" int __real_esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls);
+
+// The HTTPS server calls this from its open_fn, it accepts the client and runs the whole handshake
+extern "C" int __wrap_esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls) {
+    time_t before = time(NULL);
+    int64_t start = esp_timer_get_time();
+    int res = __real_esp_tls_server_session_create(cfg, sockfd, tls);
+    uint32_t took = (uint32_t)(esp_timer_get_time() - start);
+
+    if (res == 0) {
+        // esp_tls_conn_read and esp_tls_conn_write, which the HTTPS server uses, go through these
+        session_lock_t *s = find_session_lock(NULL);
+        if (s) {
+            s->read = tls->read;
+            s->write = tls->write;
+            s->tls = tls;
+            tls->read = locked_read;
+            tls->write = locked_write;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(stats_lock);
+    if (res != 0) {
+        stats.failed++;
+        return res;
+    }
+
+    // esp_tls_t is still public in IDF 4.4. A session restored from a ticket
+    // keeps the start time of the full handshake that created it.
+    mbedtls_ssl_context *ssl = &tls->ssl;
+    if (ssl->session && ssl->session->start < before) {
+        stats.resumed++;
+        stats.resumed_us += took;
+    } else {
+        stats.full++;
+        stats.full_us += took;
+    }
+    if (took > stats.max_us) {
+        stats.max_us = took;
+    }
+    stats.suite = mbedtls_ssl_get_ciphersuite(ssl);
+    stats.version = mbedtls_ssl_get_version(ssl);
+
+    // same socket, same context, just timed
+    if (ssl->f_send != timed_send) {
+        net_send = ssl->f_send;
+        mbedtls_ssl_set_bio(ssl, ssl->p_bio, timed_send, ssl->f_recv, ssl->f_recv_timeout);
+    }
+    return res;
+}
+
+extern "C" void __real_esp_tls_server_session_delete(esp_tls_t *tls);
+
+// The HTTPS server calls this once the session is closed, the lock outlives whatever
+// read or write is still running on it
+extern "C" void __wrap_esp_tls_server_session_delete(esp_tls_t *tls) {
+    session_lock_t *s = find_session_lock(tls);
+    if (s) {
+        std::lock_guard<std::mutex> guard(s->lock);
+        std::lock_guard<std::mutex> locks_guard(session_locks_lock);
+        s->tls = NULL;
+    }
+    __real_esp_tls_server_session_delete(tls);
+}
+#endif
+
+//public
+
+esp_err_t TlsSessions::start(httpd_handle_t *server, const httpd_config_t &config) {
+#if WEB_SERVER_TLS
+    // the plain server's socket count would not fit in RAM
+    httpd_config_t httpd_config = config;
+    httpd_config.max_open_sockets = WEB_SERVER_TLS_MAX_SOCKETS;
+    httpd_config.lru_purge_enable = true;
+
+    httpd_ssl_config_t ssl_config = HTTPD_SSL_CONFIG_DEFAULT();
+    ssl_config.httpd = httpd_config;
+    ssl_config.servercert = (const uint8_t *)tls_cert_pem;
+    ssl_config.servercert_len = sizeof(tls_cert_pem);
+    ssl_config.prvtkey_pem = (const uint8_t *)tls_key_pem;
+    ssl_config.prvtkey_len = sizeof(tls_key_pem);
+    ssl_config.port_secure = WEB_SERVER_TLS_PORT;
+    ssl_config.session_tickets = true;
+
+    esp_err_t err = httpd_ssl_start(server, &ssl_config);
+    if (err != ESP_OK) {
+        // without CONFIG_ESP_TLS_SERVER_SESSION_TICKETS in the SDK the ticket setup fails the whole start
+        Serial.println("HTTPS with session tickets failed to start, trying without");
+        ssl_config.httpd = httpd_config;
+        ssl_config.session_tickets = false;
+        err = httpd_ssl_start(server, &ssl_config);
+    }
+    if (err == ESP_OK) {
+        started = true;
+        tickets = ssl_config.session_tickets;
+        Serial.printf("HTTPS on port %d, session tickets %s\n", WEB_SERVER_TLS_PORT, tickets ? "on" : "off");
+    }
+    return err;
+#else
+    (void)server;
+    (void)config;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+int64_t TlsSessions::socket_time_us() {
+    return socket_us;
+}
+
+void TlsSessions::count_frame(size_t bytes, int64_t crypto_us) {
+    if (crypto_us < 0) {
+        crypto_us = 0;
+    }
+    std::lock_guard<std::mutex> guard(stats_lock);
+    stats.frames++;
+    stats.frame_bytes += bytes;
+    stats.crypto_us += crypto_us;
+    if (crypto_us > stats.max_frame_crypto_us) {
+        stats.max_frame_crypto_us = (uint32_t)crypto_us;
+    }
+}
+
+int TlsSessions::write_metrics(char *out, size_t len) {
+    tls_stats_t s;
+    {
+        std::lock_guard<std::mutex> guard(stats_lock);
+        s = stats;
+    }
+
+#ifdef CONFIG_MBEDTLS_HARDWARE_AES
+    const bool hw_aes = true;
+#else
+    const bool hw_aes = false;
+#endif
+#ifdef CONFIG_MBEDTLS_HARDWARE_SHA
+    const bool hw_sha = true;
+#else
+    const bool hw_sha = false;
+#endif
+
+    return snprintf(out, len,
+        "\"tls\":{\"enabled\":%s,\"port\":%d,\"tickets\":%s,\"hw_aes\":%s,\"hw_sha\":%s,"
+        "\"suite\":\"%s\",\"version\":\"%s\","
+        "\"handshakes\":{\"full\":%u,\"resumed\":%u,\"failed\":%u,\"full_avg_us\":%u,\"resumed_avg_us\":%u,\"max_us\":%u},"
+        "\"frames\":%u,\"crypto_us_per_frame\":%u,\"crypto_us_per_kb\":%u,\"max_frame_crypto_us\":%u}",
+        started ? "true" : "false", started ? WEB_SERVER_TLS_PORT : 0, tickets ? "true" : "false",
+        hw_aes ? "true" : "false", hw_sha ? "true" : "false",
+        s.suite ? s.suite : "", s.version ? s.version : "",
+        s.full, s.resumed, s.failed,
+        s.full ? (unsigned)(s.full_us / s.full) : 0, s.resumed ? (unsigned)(s.resumed_us / s.resumed) : 0, s.max_us,
+        s.frames, s.frames ? (unsigned)(s.crypto_us / s.frames) : 0,
+        s.frame_bytes >= 1024 ? (unsigned)(s.crypto_us * 1024 / (int64_t)s.frame_bytes) : 0,
+        s.max_frame_crypto_us);
+}
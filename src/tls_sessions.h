@@ -0,0 +1,57 @@
+#ifndef TLS_SESSIONS_H
+#define TLS_SESSIONS_H
+
+#include <Arduino.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+// Serve every endpoint, /stream included, over HTTPS instead of plain HTTP.
+// Needs include/tls_cert.h, see tools/make_cert.sh.
+#ifndef WEB_SERVER_TLS
+#define WEB_SERVER_TLS 0
+#endif
+
+#ifndef WEB_SERVER_TLS_PORT
+#define WEB_SERVER_TLS_PORT 443
+#endif
+
+// Every open TLS session holds 35-40 KB of internal RAM for its record buffers and
+// context, so the HTTPS server keeps fewer sockets than plain httpd's 7. With all
+// stream sessions busy one socket is left for control requests, least recently
+// used sockets are closed to make room.
+#ifndef WEB_SERVER_TLS_MAX_SOCKETS
+#define WEB_SERVER_TLS_MAX_SOCKETS 4
+#endif
+
+// Starts the HTTPS server and keeps count of what TLS costs. Clients that come back
+// with a session ticket skip the key exchange, which is most of a full handshake.
+// AES and SHA run on the crypto accelerators when mbedTLS is built with them,
+// which the Arduino core is.
+//
+// Handshakes are timed around esp_tls_server_session_create, which the linker
+// routes through here (-Wl,--wrap in platformio.ini). Encryption cost per frame is
+// the time a stream worker spends in a send minus the time spent in the socket.
+//
+// An mbedTLS context must not be used by two tasks at once, but the server task
+// reads requests from a session while a stream worker writes frames to it. Each
+// session's reads and writes go through a lock of their own, installed when the
+// session is created and dropped in esp_tls_server_session_delete, also wrapped.
+class TlsSessions {
+  public:
+    // httpd_start with TLS on top. Falls back to no tickets if mbedTLS lacks them.
+    static esp_err_t start(httpd_handle_t *server, const httpd_config_t &config);
+    static bool active() { return started; }
+
+    // Time this task has spent writing encrypted records to sockets so far
+    static int64_t socket_time_us();
+    // A stream worker sent a frame of bytes, crypto_us of its send time went to TLS itself
+    static void count_frame(size_t bytes, int64_t crypto_us);
+
+    // Write the "tls" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+
+  private:
+    static bool started;
+};
+
+#endif // TLS_SESSIONS_H
@@ -0,0 +1,41 @@
+#include "token_bucket.h"
+
+#define TOKEN_SCALE 1000000LL
+
+static void refill(token_bucket_t *tb, int64_t now_us) {
+    if (now_us > tb->last_us) {
+        // tokens are scaled by 1e6, so rate * elapsed microseconds is already in scaled units
+        tb->tokens += (int64_t)tb->rate * (now_us - tb->last_us);
+        if (tb->tokens > tb->burst) {
+            tb->tokens = tb->burst;
+        }
+    }
+    tb->last_us = now_us;
+}
+
+void token_bucket_init(token_bucket_t *tb, uint32_t rate, uint32_t burst, int64_t now_us) {
+    tb->rate = rate;
+    tb->burst = (int64_t)(burst ? burst : 1) * TOKEN_SCALE;
+    tb->tokens = tb->burst;
+    tb->last_us = now_us;
+}
+
+int64_t token_bucket_delay_us(token_bucket_t *tb, int64_t now_us) {
+    if (tb->rate == 0) {
+        return 0;
+    }
+    refill(tb, now_us);
+    if (tb->tokens >= 0) {
+        return 0;
+    }
+    // round up, so waiting that long is always enough
+    return (-tb->tokens + tb->rate - 1) / tb->rate;
+}
+
+void token_bucket_take(token_bucket_t *tb, uint32_t amount, int64_t now_us) {
+    if (tb->rate == 0) {
+        return;
+    }
+    refill(tb, now_us);
+    tb->tokens -= (int64_t)amount * TOKEN_SCALE;
+}
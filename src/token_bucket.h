@@ -0,0 +1,30 @@
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+// Token bucket for pacing a stream, e.g. frames per second or bytes per second.
+//
+// Tokens refill at rate per second up to burst. A sender waits until the bucket is
+// not in debt, then takes what it sent, which may push the bucket below zero. That
+// way a frame larger than the burst still goes out, and the debt spaces out the next
+// one. Time is passed in by the caller, so this has no Arduino dependency and can
+// be tested on the host.
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t rate;   // tokens per second, 0 means unlimited
+    int64_t burst;   // most tokens the bucket holds, scaled by 1e6
+    int64_t tokens;  // scaled by 1e6, negative while in debt
+    int64_t last_us; // time of the last refill
+} token_bucket_t;
+
+// The bucket starts full
+void token_bucket_init(token_bucket_t *tb, uint32_t rate, uint32_t burst, int64_t now_us);
+
+// Microseconds until the bucket is out of debt, 0 when sending is allowed now
+int64_t token_bucket_delay_us(token_bucket_t *tb, int64_t now_us);
+
+// Take tokens for what was just sent
+void token_bucket_take(token_bucket_t *tb, uint32_t amount, int64_t now_us);
+
+#endif // TOKEN_BUCKET_H
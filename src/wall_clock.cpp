@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include "wall_clock.h"
+
+volatile uint32_t WallClock::sync_count = 0;
+volatile int64_t WallClock::last_sync_us = 0;
+
+//public
+
+void WallClock::init() {
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, SNTP_SERVER);
+    sntp_set_time_sync_notification_cb(on_sync);
+    // slew small corrections instead of stepping, the first sync still steps
+    sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
+    sntp_set_sync_interval(SNTP_SYNC_INTERVAL_MS);
+    sntp_init();
+}
+
+void WallClock::from_monotonic(const struct timeval &mono, struct timeval *wall) {
+    // read both clocks back to back, the difference between them is the offset right now
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t mono_now = esp_timer_get_time();
+
+    int64_t offset = (int64_t)now.tv_sec * 1000000LL + now.tv_usec - mono_now;
+    int64_t us = (int64_t)mono.tv_sec * 1000000LL + mono.tv_usec + offset;
+    wall->tv_sec = us / 1000000LL;
+    wall->tv_usec = us % 1000000LL;
+}
+
+int WallClock::write_metrics(char *out, size_t len) {
+    int64_t age_s = sync_count ? (esp_timer_get_time() - last_sync_us) / 1000000LL : -1;
+    return snprintf(out, len,
+        "\"clock\":{\"synced\":%s,\"syncs\":%u,\"last_sync_age_s\":%lld,\"server\":\"%s\"}",
+        synced() ? "true" : "false", sync_count, (long long)age_s, SNTP_SERVER);
+}
+
+//private
+
+void WallClock::on_sync(struct timeval *tv) {
+    last_sync_us = esp_timer_get_time();
+    sync_count++;
+    Serial.printf("SNTP sync %u: %lld.%06ld\n", sync_count, (long long)tv->tv_sec, (long)tv->tv_usec);
+}
@@ -0,0 +1,42 @@
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#include <Arduino.h>
+#include <sys/time.h>
+
+#ifndef SNTP_SERVER
+#define SNTP_SERVER "pool.ntp.org"
+#endif
+
+// How often SNTP polls the server. Between polls the clock is slewed, not stepped,
+// so frame timestamps never jump backwards.
+#ifndef SNTP_SYNC_INTERVAL_MS
+#define SNTP_SYNC_INTERVAL_MS (15 * 60 * 1000)
+#endif
+
+// Wall clock for frame timestamps. The camera driver stamps frames with esp_timer
+// time at VSYNC, which is monotonic but starts at boot. SNTP disciplines the system
+// clock, and from_monotonic maps a driver timestamp onto it, so frames from several
+// cameras synced to the same server can be lined up.
+class WallClock {
+  public:
+    // Start SNTP, call once Wi-Fi is up
+    static void init();
+
+    // True once the first SNTP reply arrived, before that wall time counts from 1970 + uptime
+    static bool synced() { return sync_count > 0; }
+
+    // Convert an esp_timer based timestamp into wall clock time
+    static void from_monotonic(const struct timeval &mono, struct timeval *wall);
+
+    // Write the "clock" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+
+  private:
+    static void on_sync(struct timeval *tv);
+
+    static volatile uint32_t sync_count;
+    static volatile int64_t last_sync_us;
+};
+
+#endif // WALL_CLOCK_H
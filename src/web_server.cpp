@@ -2,40 +2,35 @@
 #include "web_server.h"
 #include <esp_camera.h>
 #include "camera_hal.h"
+#include "sensor_settings.h"
+#include "sensor_queue.h"
+#include "sweep_grid.h"
+#include "exposure_stats.h"
+#include "frame_check.h"
+#include "reg_dump.h"
+#include "memory_manager.h"
+#include "capture_task.h"
+#include "preview_encoder.h"
+#include "task_monitor.h"
+#include "task_config.h"
+#include "wall_clock.h"
+#include "stream_format.h"
+#include "stream_sessions.h"
+#include "web_ui.h"
+#include "tls_sessions.h"
+#include "timelapse.h"
 
 httpd_handle_t WebServer::server = NULL;
 
-// A unique string that separates individual JPEG frames in a multipart MIME stream
-#define PART_BOUNDARY "123456789000000000000987654321"
-static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\n\r\n";
-
-static const char* HTML_STREAM = R"(
-<!DOCTYPE html>
-<html>
-<body>
-    <img src="/stream" />
-</body>
-</html>
-)";
-
-static const char* HTML = R"(
-<!DOCTYPE html>
-<html>
-<body>
-    <p>Welcome to the CaliCam Web Server!</p>
-</body>
-</html>
-)";
-
-typedef struct setting_handler_t {
-    //pointer to the setting string
-    const char *key;
-    //pointer to function that sets the variable
-    //passing two arguments, the camera sensor struct ( im sensor.h), and val to set
-    int (*handler)(sensor_t *, int);
-} setting_handler_t;
+// /sweep keeps every part, so it uses multipart/mixed rather than x-mixed-replace
+static const char *_SWEEP_CONTENT_TYPE = "multipart/mixed;boundary=" PART_BOUNDARY;
+static const char *_SWEEP_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Sequence: %u\r\nX-Sweep-Index: %u\r\nX-Sweep-Values: %s\r\n\r\n";
+static const char *_SWEEP_END = "\r\n--" PART_BOUNDARY "--\r\n";
+
+// how long a handler waits for the capture task to publish a frame
+#define FRAME_TIMEOUT_MS 3000
+// longest wait a /frame long-poll may ask for
+#define FRAME_MAX_TIMEOUT_MS 10000
 
 static int print_reg(char *p_json, sensor_t *sensor, uint16_t reg, uint32_t mask){
     return sprintf(p_json, "\"0x%x\":%u,", reg, sensor->get_reg(sensor, reg, mask));
@@ -44,8 +39,23 @@ static int print_reg(char *p_json, sensor_t *sensor, uint16_t reg, uint32_t mask
 esp_err_t WebServer::init() {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
-
-    if (httpd_start(&server, &config) != ESP_OK) {
+    // the default of 8 handlers is already used up by the routes below
+    config.max_uri_handlers = 32;
+    // keep the server next to the Wi-Fi and lwIP tasks, capture runs on the other core
+    config.core_id = NET_CORE;
+    config.task_priority = HTTPD_TASK_PRIORITY;
+    config.stack_size = HTTPD_TASK_STACK;
+    // stream workers write to sockets outside the server task, they need to hear when one closes
+    config.close_fn = StreamSessions::on_close;
+    // /ui/* serves the hashed UI assets
+    config.uri_match_fn = httpd_uri_match_wildcard;
+
+    // with WEB_SERVER_TLS the same server and handlers sit behind TLS on WEB_SERVER_TLS_PORT instead
+    esp_err_t err = WEB_SERVER_TLS ? TlsSessions::start(&server, config) : httpd_start(&server, &config);
+    if (err != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (StreamSessions::init(server) != ESP_OK) {
         return ESP_FAIL;
     }
 
@@ -56,6 +66,13 @@ esp_err_t WebServer::init() {
         .user_ctx = NULL
     };
 
+    httpd_uri_t uri_ui = {
+        .uri = "/ui/*",
+        .method = HTTP_GET,
+        .handler = handle_ui,
+        .user_ctx = NULL
+    };
+
     httpd_uri_t uri_stream = {
         .uri = "/stream",
         .method = HTTP_GET,
@@ -84,7 +101,7 @@ esp_err_t WebServer::init() {
         .user_ctx = NULL
     };
 
-    httpd_uri_t uri_stat = {
+    httpd_uri_t uri_xclk = {
         .uri = "/xclk",
         .method = HTTP_GET,
         .handler = handle_xclk,
@@ -108,11 +125,82 @@ esp_err_t WebServer::init() {
     httpd_uri_t uri_spll = {
         .uri = "/spll",
         .method = HTTP_GET,
-        .handler = handle_setreg,
+        .handler = handle_setpll,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_metrics = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = handle_metrics,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_fbconfig = {
+        .uri = "/fbconfig",
+        .method = HTTP_GET,
+        .handler = handle_fbconfig,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_bench = {
+        .uri = "/bench",
+        .method = HTTP_GET,
+        .handler = handle_bench,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_sweep = {
+        .uri = "/sweep",
+        .method = HTTP_GET,
+        .handler = handle_sweep,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_histogram = {
+        .uri = "/histogram",
+        .method = HTTP_GET,
+        .handler = handle_histogram,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_integrity = {
+        .uri = "/integrity",
+        .method = HTTP_GET,
+        .handler = handle_integrity,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_regdump = {
+        .uri = "/regdump",
+        .method = HTTP_GET,
+        .handler = handle_regdump,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_raw = {
+        .uri = "/raw",
+        .method = HTTP_GET,
+        .handler = handle_raw,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_frame = {
+        .uri = "/frame",
+        .method = HTTP_GET,
+        .handler = handle_frame,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t uri_timelapse = {
+        .uri = "/timelapse",
+        .method = HTTP_GET,
+        .handler = handle_timelapse,
         .user_ctx = NULL
     };
 
     httpd_register_uri_handler(server, &uri);
+    httpd_register_uri_handler(server, &uri_ui);
     httpd_register_uri_handler(server, &uri_stream);
     httpd_register_uri_handler(server, &uri_snapshot);
     httpd_register_uri_handler(server, &uri_cmd);
@@ -120,87 +208,63 @@ esp_err_t WebServer::init() {
     httpd_register_uri_handler(server, &uri_greg);
     httpd_register_uri_handler(server, &uri_sreg);
     httpd_register_uri_handler(server, &uri_spll);
+    httpd_register_uri_handler(server, &uri_xclk);
+    httpd_register_uri_handler(server, &uri_metrics);
+    httpd_register_uri_handler(server, &uri_fbconfig);
+    httpd_register_uri_handler(server, &uri_bench);
+    httpd_register_uri_handler(server, &uri_sweep);
+    httpd_register_uri_handler(server, &uri_histogram);
+    httpd_register_uri_handler(server, &uri_integrity);
+    httpd_register_uri_handler(server, &uri_regdump);
+    httpd_register_uri_handler(server, &uri_raw);
+    httpd_register_uri_handler(server, &uri_frame);
+    httpd_register_uri_handler(server, &uri_timelapse);
 
     return ESP_OK;
 }
 
 esp_err_t WebServer::handle_index(httpd_req_t *req) {
-    return httpd_resp_send(req, HTML, strlen(HTML));
+    return WebUi::send(req, WebUi::find("/"));
+}
+
+esp_err_t WebServer::handle_ui(httpd_req_t *req) {
+    const web_asset_t *asset = WebUi::find(req->uri);
+    if (!asset) {
+        return httpd_resp_send_404(req);
+    }
+    return WebUi::send(req, asset);
 }
 
 esp_err_t WebServer::handle_stream(httpd_req_t *req) {
     // To Do: is this really the best way? What about a websocket here?
-    while(true) {
-        Serial.println("Camera frame capture starting..");
-        // Get frame from camera
-        camera_fb_t *frame = esp_camera_fb_get();
-        
-        if (!frame) {
-            Serial.println("Camera frame capture failed");
-            // return -1 if the frame was not captured
-            return ESP_FAIL;
-        }
 
-        // configure the http headers to militpart mime stream
-        esp_err_t res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-        if (res != ESP_OK) {
-            return res;
+    // /stream?fps=N caps the frame rate, maxkbps=M the bandwidth of this client,
+    // stats=1 adds an X-Luma header with the latest exposure stats to every part
+    char param[96];
+    char val[16];
+    stream_params_t params = {};
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK) {
+        if (httpd_query_key_value(param, "fps", val, sizeof(val)) == ESP_OK) {
+            params.fps = strtoul(val, NULL, 10);
         }
-
-        // return a stream boundry header in response to http request
-        res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-        if (res != ESP_OK) {
-            // return the framebuffer for reuse
-            esp_camera_fb_return(frame);
-            return res;     
+        if (httpd_query_key_value(param, "maxkbps", val, sizeof(val)) == ESP_OK) {
+            params.max_kbps = strtoul(val, NULL, 10);
         }
+        params.with_stats = httpd_query_key_value(param, "stats", val, sizeof(val)) == ESP_OK && !strcmp(val, "1");
+    }
 
-        // this should be large enough for the part header, 80 bytes is enough for the header, but we use 128 to be safe ( 64 * 2 )
-        char part_buf[128]; 
-
-        // Get current timestamp
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-
-        // write the mime part header info into the part buffer
-        // snprintf returns the number of bytes written, so we can use it to send the chunk
-        // the part header contains the content type, content length, and timestamp
-        size_t part_len = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, frame->len, frame->timestamp.tv_sec, frame->timestamp.tv_usec);
-
-        // ESP32's HTTP server function for sending partial responses
-        res = httpd_resp_send_chunk(req, part_buf, part_len);
-        //if the response was not sent successfully, return the framebuffer for reuse, and return the error code for the caller
-        if (res != ESP_OK) {
-            esp_camera_fb_return(frame);
-            return res;
-        }
-
-
-        // send jpeg data
-        res = httpd_resp_send_chunk(req, (const char *)frame->buf, frame->len);
-        if (res != ESP_OK) {
-            // return the framebuffer for reuse
-            esp_camera_fb_return(frame);
-            return res;
-        }
-
-        // // Debug print frame data
-        // Serial.println("######### Frame ########");
-        // for(size_t i = 0; i < frame->len; i++) {
-        //     Serial.printf("%02X ", frame->buf[i]);
-        // }    
-        // Serial.println("######### Frame ########");
-
-        // release frame
-        esp_camera_fb_return(frame);
-
+    // a worker task takes the socket from here, the server task goes straight back to other requests
+    if (StreamSessions::admit(req, params) != ESP_OK) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_sendstr(req, "Too many streams");
     }
+    return ESP_OK;
 }
 
 esp_err_t WebServer::handle_snapshot(httpd_req_t *req) {
-    Serial.println("Camera frame capture starting..");
-    // Get frame from camera
-    camera_fb_t *frame = esp_camera_fb_get();
+    // Wait for the next frame the capture task publishes, so the snapshot is never older than the request
+    frame_t *frame = CaptureTask::acquire_next(CaptureTask::latest_seq(), FRAME_TIMEOUT_MS);
 
     if (!frame) {
         Serial.println("Camera frame capture failed");
@@ -215,20 +279,30 @@ esp_err_t WebServer::handle_snapshot(httpd_req_t *req) {
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-    // Format timestamp from frame->timestamp to "seconds.microseconds"
+    // Format the wall clock capture time to "seconds.microseconds"
     char ts_header[32];
     // snprintf formats the timestamp into a string with seconds and microseconds
-    snprintf(ts_header, sizeof(ts_header), "%ld.%06ld", frame->timestamp.tv_sec, frame->timestamp.tv_usec);
+    snprintf(ts_header, sizeof(ts_header), "%lld.%06ld", (long long)frame->wall.tv_sec, (long)frame->wall.tv_usec);
     // Set the X-Timestamp header to unix style formatted timestamp
     httpd_resp_set_hdr(req, "X-Timestamp", ts_header);
+    char seq_header[16];
+    snprintf(seq_header, sizeof(seq_header), "%u", frame->seq);
+    httpd_resp_set_hdr(req, "X-Sequence", seq_header);
 
     
     esp_err_t res = httpd_resp_send(req, (const char *)frame->buf, frame->len);
-    esp_camera_fb_return(frame);
+    CaptureTask::release(frame);
 
     return res;
 }
 
+// The sensor queue was full or the capture task did not get to the command in time
+static esp_err_t send_queue_error(httpd_req_t *req, esp_err_t err) {
+    Serial.printf("Sensor queue error 0x%x\n", err);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_sendstr(req, err == ESP_ERR_NO_MEM ? "Sensor queue full" : "Sensor queue timeout");
+}
+
 esp_err_t WebServer::handle_command(httpd_req_t *req) { 
 
     char param[256];
@@ -265,70 +339,22 @@ esp_err_t WebServer::handle_command(httpd_req_t *req) {
             value = std::stoi(val);
             // Use serial printf for variables in the logging
             Serial.printf("%s = %d\n", key, value);
-    
-            // get the camera sensor
-            sensor_t *sensor = CameraHal::get_sensor();
-            if(!sensor) {
-                Serial.println("Failed to get camera sensor");
-                return ESP_FAIL;
-            }
-    
 
-        // set the corresponding values
-        // We could set the variables using strcmp and a big if-else block, 
-        // but there is a better way with dispatch tables and lambda functions
-
-
-        // Each key associates a lambda function that takes a pointer to the sensor struct and an val to set
-        // The lambda then calls the setter function on for each paramter to update that particular setting.
-        static setting_handler_t handlers[] = {
-            { "framesize", [](sensor_t *s, int val) {
-                return s->pixformat == PIXFORMAT_JPEG ? s->set_framesize(s, (framesize_t)val) : ESP_OK;
-            }},
-            //key              []inherit nothing into the lambda function, (sensor_t *s, int val) the function takes two parameters.
-            { "contrast",      [](sensor_t *s, int val) { return s->set_contrast(s, val); } },
-            { "brightness",    [](sensor_t *s, int val) { return s->set_brightness(s, val); } },
-            { "saturation",    [](sensor_t *s, int val) { return s->set_saturation(s, val); } },
-            { "gainceiling",   [](sensor_t *s, int val) { return s->set_gainceiling(s, (gainceiling_t)val); } },
-            { "quality",       [](sensor_t *s, int val) { return s->set_quality(s, val); } },
-            { "colorbar",      [](sensor_t *s, int val) { return s->set_colorbar(s, val); } },
-            { "awb",           [](sensor_t *s, int val) { return s->set_whitebal(s, val); } },
-            { "agc",           [](sensor_t *s, int val) { return s->set_gain_ctrl(s, val); } },
-            { "aec",           [](sensor_t *s, int val) { return s->set_exposure_ctrl(s, val); } },
-            { "hmirror",       [](sensor_t *s, int val) { return s->set_hmirror(s, val); } },
-            { "vflip",         [](sensor_t *s, int val) { return s->set_vflip(s, val); } },
-            { "aec2",          [](sensor_t *s, int val) { return s->set_aec2(s, val); } },
-            { "awb_gain",      [](sensor_t *s, int val) { return s->set_awb_gain(s, val); } },
-            { "agc_gain",      [](sensor_t *s, int val) { return s->set_agc_gain(s, val); } },
-            { "aec_value",     [](sensor_t *s, int val) { return s->set_aec_value(s, val); } },
-            { "special_effect",[](sensor_t *s, int val) { return s->set_special_effect(s, val); } },
-            { "wb_mode",       [](sensor_t *s, int val) { return s->set_wb_mode(s, val); } },
-            { "ae_level",      [](sensor_t *s, int val) { return s->set_ae_level(s, val); } },
-            { "dcw",           [](sensor_t *s, int val) { return s->set_dcw(s, val); } },
-            { "bpc",           [](sensor_t *s, int val) { return s->set_bpc(s, val); } },
-            { "wpc",           [](sensor_t *s, int val) { return s->set_wpc(s, val); } },
-            { "raw_gma",       [](sensor_t *s, int val) { return s->set_raw_gma(s, val); } },
-            { "lenc",          [](sensor_t *s, int val) { return s->set_lenc(s, val); } }
-        };
-
-        // Check if the provided key matches any known handler; handle unknown commands below.
-        // Get the number of handlers in the handlers struct
-        #define NUM_HANDLERS (sizeof(handlers) / sizeof(handlers[0]))
-
-        res = -1;
-
-        for(int i = 0; i < NUM_HANDLERS; i++){
-            if (!strcmp(key, handlers[i].key)) {
-                res = handlers[i].handler(sensor, value);
-                break;
-            }
+        // queue the setting for the next frame boundary, -1 means the key is unknown
+        sensor_result_t result;
+        res = SensorQueue::setting(key, value, &result);
+        if (res != ESP_OK) {
+            return send_queue_error(req, res);
         }
-        if (res == -1) {
+        if (result.res == -1) {
             Serial.println("Unknown command");
             return ESP_FAIL;
         }
 
-        // send response
+        // send response, X-Sequence is the first frame that shows the change (0 if not known)
+        char seq_header[16];
+        snprintf(seq_header, sizeof(seq_header), "%u", result.seq);
+        httpd_resp_set_hdr(req, "X-Sequence", seq_header);
         httpd_resp_sendstr(req, "OK");
         return ESP_OK;
        
@@ -337,12 +363,10 @@ esp_err_t WebServer::handle_command(httpd_req_t *req) {
      return ESP_FAIL;
 }
 
-esp_err_t WebServer::handle_status(httpd_req_t *req) {
-
-    static char json_response[1024];
-
-    sensor_t *sensor = esp_camera_sensor_get();
-    char *p_json = json_response;
+// Runs on the capture task through the sensor queue, so the register reads cannot race a write.
+// ctx is a MEM_BUFFER_SIZE pool buffer.
+static int write_status(sensor_t *sensor, void *ctx) {
+    char *p_json = (char *)ctx;
     uint16_t installed_sensor = sensor->id.PID;
     const char *name = camera_model_name(installed_sensor);
 
@@ -447,10 +471,92 @@ esp_err_t WebServer::handle_status(httpd_req_t *req) {
     }
     *p_json++ = '}';
     *p_json = 0;
+    return 0;
+}
+
+esp_err_t WebServer::handle_status(httpd_req_t *req) {
+
+    // take a scratch buffer from the pool instead of a static one, so two
+    // concurrent requests cannot scribble over each other's output
+    char *json_response = (char *)MemoryManager::buffers().alloc();
+    if (!json_response) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Out of response buffers");
+    }
+
+    sensor_result_t result;
+    esp_err_t err = SensorQueue::call(write_status, json_response, &result);
+    if (err != ESP_OK) {
+        MemoryManager::buffers().free(json_response);
+        return send_queue_error(req, err);
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = httpd_resp_send(req, json_response, strlen(json_response));
+    MemoryManager::buffers().free(json_response);
+    return res;
+}
+
+// Each subsystem writes one member of the /metrics object, snprintf style
+typedef int (*metrics_writer_t)(char *out, size_t len);
+
+// What a writer actually left in a buffer of avail bytes. Writers report what they
+// wanted to write like snprintf does, which is more than avail when they ran out.
+static size_t metrics_fitted(int written, size_t avail) {
+    if (written <= 0) {
+        return 0;
+    }
+    return (size_t)written < avail ? (size_t)written : (avail ? avail - 1 : 0);
+}
+
+static const metrics_writer_t metrics_writers[] = {
+    MemoryManager::write_metrics,
+    CaptureTask::write_metrics,
+    TaskMonitor::write_metrics,
+    FrameCheck::write_metrics,
+    PreviewEncoder::write_metrics,
+    SensorQueue::write_metrics,
+    WallClock::write_metrics,
+    StreamSessions::write_metrics,
+    WebUi::write_metrics,
+    TlsSessions::write_metrics,
+    TimeLapse::write_metrics,
+};
+
+esp_err_t WebServer::handle_metrics(httpd_req_t *req) {
+
+    char *json_response = (char *)MemoryManager::buffers().alloc();
+    if (!json_response) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Out of response buffers");
+    }
+
+    // always keep room for the separator, the closing brace and the terminator
+    size_t len = MEM_BUFFER_SIZE - 3;
+    size_t n = 0;
+
+    json_response[n++] = '{';
+    for (size_t i = 0; i < sizeof(metrics_writers) / sizeof(metrics_writers[0]); i++) {
+        // a writer that filled the buffer leaves no room for the next one, the
+        // separator would otherwise push n past len and the next avail would wrap
+        if (n + 1 >= len) {
+            break;
+        }
+        if (i) {
+            json_response[n++] = ',';
+        }
+        size_t avail = len - n;
+        n += metrics_fitted(metrics_writers[i](json_response + n, avail), avail);
+    }
+    json_response[n++] = '}';
+    json_response[n] = 0;
 
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_send(req, json_response, strlen(json_response));
+    esp_err_t res = httpd_resp_send(req, json_response, n);
+    MemoryManager::buffers().free(json_response);
+    return res;
 }
 
 esp_err_t WebServer::handle_xclk(httpd_req_t *req) {
@@ -488,12 +594,20 @@ esp_err_t WebServer::handle_xclk(httpd_req_t *req) {
         // Use serial printf for variables in the logging
         Serial.printf("%s = %d\n", key, xclock);
 
-        sensor_t *sensor = esp_camera_sensor_get();
-        int set_res = sensor->set_xclk(sensor, LEDC_TIMER_0, xclock);
-        if (set_res) {
+        sensor_result_t result;
+        res = SensorQueue::set_xclk(xclock, &result);
+        if (res != ESP_OK) {
+            return send_queue_error(req, res);
+        }
+        if (result.res) {
             return httpd_resp_send_500(req);
         }
+        // bucket integrity counters by the new clock
+        FrameCheck::set_xclk(xclock);
 
+        char seq_header[16];
+        snprintf(seq_header, sizeof(seq_header), "%u", result.seq);
+        httpd_resp_set_hdr(req, "X-Sequence", seq_header);
         httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
         return httpd_resp_send(req, NULL, 0);
     }
@@ -531,8 +645,12 @@ esp_err_t WebServer::handle_getreg(httpd_req_t *req) {
     int reg = strtol(reg_str, NULL, 0);
     int mask = strtol(mask_str, NULL, 0);
 
-    sensor_t *sensor = esp_camera_sensor_get();
-    int value = sensor->get_reg(sensor, reg, mask);
+    sensor_result_t result;
+    res = SensorQueue::read_reg(reg, mask, &result);
+    if (res != ESP_OK) {
+        return send_queue_error(req, res);
+    }
+    int value = result.value;
     if (value < 0) {
         return httpd_resp_send_500(req);
     }
@@ -597,17 +715,20 @@ esp_err_t WebServer::handle_setreg(httpd_req_t *req) {
     Serial.printf("register: 0x%04x, mask: 0x%04x, value: 0x%08x, masked value: 0x%08x\n",
         reg, mask, value, (value & mask));
 
-    snprintf(response, sizeof(response),
-             "{ \"reg\": \"0x%X\", \"mask\": \"0x%X\", \"value\": \"0x%X\", \"masked\": \"0x%X\" }",
-             reg, mask, value, value & mask);
-
-
-    sensor_t *sensor = esp_camera_sensor_get();
-    int res = sensor->set_reg(sensor, reg, mask, value);
-    if (res) {
+    sensor_result_t result;
+    res = SensorQueue::write_reg(reg, mask, value, &result);
+    if (res != ESP_OK) {
+        return send_queue_error(req, res);
+    }
+    if (result.res) {
         return httpd_resp_send_500(req);
     }
 
+    // seq is the first frame captured with the new value, 0 if that is not known
+    snprintf(response, sizeof(response),
+             "{ \"reg\": \"0x%X\", \"mask\": \"0x%X\", \"value\": \"0x%X\", \"masked\": \"0x%X\", \"seq\": %u }",
+             reg, mask, value, value & mask, result.seq);
+
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     httpd_resp_set_type(req, "application/json");
 
@@ -668,11 +789,25 @@ esp_err_t WebServer::handle_setpll(httpd_req_t *req) {
     Serial.printf("Set PLL: bypass=%d, mul=%d, sys=%d, root=%d, pre=%d, seld5=%d, pclken=%d, pclk=%d\n",
         pll.bypass, pll.mul, pll.sys, pll.root, pll.pre, pll.seld5, pll.pclken, pll.pclk);
 
-    sensor_t *sensor = esp_camera_sensor_get();
-    if (sensor->set_pll(sensor, pll.bypass, pll.mul, pll.sys, pll.root, pll.pre, pll.seld5, pll.pclken, pll.pclk)) {
+    const int pll_values[8] = { pll.bypass, pll.mul, pll.sys, pll.root, pll.pre, pll.seld5, pll.pclken, pll.pclk };
+    sensor_result_t result;
+    res = SensorQueue::set_pll(pll_values, &result);
+    if (res != ESP_OK) {
+        return send_queue_error(req, res);
+    }
+    if (result.res) {
         return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to set PLL");
     }
 
+    // bucket integrity counters by the new PLL settings
+    char pll_desc[32];
+    snprintf(pll_desc, sizeof(pll_desc), "%d,%d,%d,%d,%d,%d,%d,%d",
+        pll.bypass, pll.mul, pll.sys, pll.root, pll.pre, pll.seld5, pll.pclken, pll.pclk);
+    FrameCheck::set_pll(pll_desc);
+
+    char seq_header[16];
+    snprintf(seq_header, sizeof(seq_header), "%u", result.seq);
+    httpd_resp_set_hdr(req, "X-Sequence", seq_header);
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
     // More informative response:
@@ -754,4 +889,716 @@ esp_err_t handle_setresolution(httpd_req_t *req){
 
 
 
-}
\ No newline at end of file
+}
+static int print_buffer_config(char *out, size_t len, const camera_buffer_config_t &cfg) {
+    return snprintf(out, len,
+        "{\"fb_count\":%u,\"grab_mode\":\"%s\",\"fb_location\":\"%s\",\"xclk\":%d}",
+        (unsigned)cfg.fb_count,
+        cfg.grab_mode == CAMERA_GRAB_LATEST ? "latest" : "empty",
+        cfg.fb_location == CAMERA_FB_IN_PSRAM ? "psram" : "dram",
+        cfg.xclk_freq_hz);
+}
+
+esp_err_t WebServer::handle_fbconfig(httpd_req_t *req) {
+
+    char param[256];
+    char val[16];
+    char response[128];
+
+    camera_buffer_config_t cfg = CameraHal::get_buffer_config();
+    bool changed = false;
+
+    // without a query string just report the current configuration
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK) {
+
+        // presets first, so individual keys can still override them
+        if (httpd_query_key_value(param, "mode", val, sizeof(val)) == ESP_OK) {
+            if (!strcmp(val, "latency")) {
+                cfg = CAMERA_BUFFERS_LOW_LATENCY;
+            } else if (!strcmp(val, "nodrop")) {
+                cfg = CAMERA_BUFFERS_NO_DROPS;
+            } else {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mode must be latency or nodrop");
+            }
+            changed = true;
+        }
+        if (httpd_query_key_value(param, "fb_count", val, sizeof(val)) == ESP_OK) {
+            cfg.fb_count = atoi(val);
+            changed = true;
+        }
+        if (httpd_query_key_value(param, "grab", val, sizeof(val)) == ESP_OK) {
+            cfg.grab_mode = !strcmp(val, "empty") ? CAMERA_GRAB_WHEN_EMPTY : CAMERA_GRAB_LATEST;
+            changed = true;
+        }
+        if (httpd_query_key_value(param, "location", val, sizeof(val)) == ESP_OK) {
+            cfg.fb_location = !strcmp(val, "dram") ? CAMERA_FB_IN_DRAM : CAMERA_FB_IN_PSRAM;
+            changed = true;
+        }
+        if (httpd_query_key_value(param, "xclk", val, sizeof(val)) == ESP_OK) {
+            cfg.xclk_freq_hz = atoi(val);
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        esp_err_t err = CameraHal::reconfigure(cfg);
+        if (err == ESP_ERR_INVALID_ARG) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "fb_count must be 1-4");
+        }
+        if (err != ESP_OK) {
+            Serial.printf("Frame buffer reconfigure failed with error 0x%x\n", err);
+            return httpd_resp_send_500(req);
+        }
+        FrameCheck::set_xclk(CameraHal::get_buffer_config().xclk_freq_hz / 1000000);
+    }
+
+    print_buffer_config(response, sizeof(response), CameraHal::get_buffer_config());
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t WebServer::handle_bench(httpd_req_t *req) {
+
+    char param[64];
+    char val[16];
+    char config_json[128];
+    char response[512];
+    uint32_t frames = 30;
+
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK &&
+        httpd_query_key_value(param, "frames", val, sizeof(val)) == ESP_OK) {
+        frames = atoi(val);
+    }
+    // keep the httpd task from being tied up for too long
+    if (frames < 1 || frames > 200) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "frames must be 1-200");
+    }
+
+    // take the camera away from the capture task so the numbers are not split between the two
+    camera_bench_result_t result;
+    CaptureTask::pause();
+    esp_err_t err = CameraHal::benchmark(frames, &result);
+    CaptureTask::resume();
+    if (err != ESP_OK) {
+        return httpd_resp_send_500(req);
+    }
+
+    print_buffer_config(config_json, sizeof(config_json), CameraHal::get_buffer_config());
+    snprintf(response, sizeof(response),
+        "{\"config\":%s,\"frames\":%u,\"failures\":%u,\"elapsed_us\":%u,\"fps\":%.2f,"
+        "\"latency_avg_us\":%u,\"latency_max_us\":%u,\"wait_avg_us\":%u,\"bytes_avg\":%u}",
+        config_json, result.frames, result.failures, result.elapsed_us, result.fps,
+        result.latency_avg_us, result.latency_max_us, result.wait_avg_us, result.bytes_avg);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+
+// Queue one value of one sweep axis, result.seq is the first frame that has it
+static int apply_sweep_axis(const sweep_axis_t *axis, int value, sensor_result_t *result) {
+    esp_err_t err = axis->kind == SWEEP_AXIS_REGISTER
+        ? SensorQueue::write_reg(axis->reg, axis->mask, value, result)
+        : SensorQueue::setting(axis->key, value, result);
+    return err != ESP_OK ? err : result->res;
+}
+
+// Read back what the sensor is actually using for one sweep axis, false if it cannot be read
+static bool read_sweep_axis(sensor_t *sensor, const sweep_axis_t *axis, int *value) {
+    if (axis->kind == SWEEP_AXIS_REGISTER) {
+        sensor_result_t result;
+        if (SensorQueue::read_reg(axis->reg, axis->mask, &result) != ESP_OK) {
+            return false;
+        }
+        *value = result.value;
+        return *value >= 0;
+    }
+    // settings come from the driver's status cache, no bus access
+    return sensor_read_setting(sensor, axis->key, value);
+}
+
+// What the /sweep worker gets, in one pool buffer: the grid and where each axis started
+typedef struct {
+    sweep_grid_t grid;
+    int original[SWEEP_MAX_AXES];
+} sweep_job_t;
+
+// Runs on a stream worker: step through the grid, send one part per point, then restore
+static void run_sweep(stream_session_t *session, void *arg) {
+    sweep_job_t *job = *(sweep_job_t **)arg;
+    sweep_grid_t *grid = &job->grid;
+    sensor_t *sensor = CameraHal::get_sensor();
+    char tags[256];
+    char part_buf[384];
+    int values[SWEEP_MAX_AXES];
+
+    bool ok = StreamSessions::job_begin(session, _SWEEP_CONTENT_TYPE);
+    for (uint32_t n = 0; n < grid->points && ok; n++) {
+        sweep_grid_point(grid, n, values);
+        // the queue answers with the first frame captured after each write, wait for the latest of those
+        uint32_t first_seq = 0;
+        bool known = true;
+        for (int i = 0; i < grid->axis_count; i++) {
+            sensor_result_t result = {};
+            if (apply_sweep_axis(&grid->axes[i], values[i], &result)) {
+                Serial.printf("Sweep: failed to set %s = %d\n", grid->axes[i].key, values[i]);
+            }
+            known = known && result.seq != 0;
+            first_seq = result.seq > first_seq ? result.seq : first_seq;
+        }
+
+        // then skip the settle frames. Without a sequence, assume the frame being exposed
+        // while we wrote is torn and skip it as well
+        uint32_t after = known ? first_seq - 1 + grid->settle
+                               : CaptureTask::latest_seq() + 1 + grid->settle;
+        frame_t *frame = CaptureTask::acquire_next(after, FRAME_TIMEOUT_MS + grid->settle * 200);
+        if (!frame) {
+            Serial.println("Sweep: timed out waiting for a frame");
+            ok = false;
+            break;
+        }
+
+        // tag the frame with what the sensor reports now, not with what we asked for
+        size_t t = 0;
+        tags[0] = 0;
+        for (int i = 0; i < grid->axis_count && t < sizeof(tags); i++) {
+            int actual = -1;
+            read_sweep_axis(sensor, &grid->axes[i], &actual);
+            t += snprintf(tags + t, sizeof(tags) - t, "%s%s=%d", i ? ";" : "", grid->axes[i].key, actual);
+        }
+
+        size_t part_len = snprintf(part_buf, sizeof(part_buf), _SWEEP_PART,
+            frame->len, frame->seq, n, tags);
+
+        ok = StreamSessions::job_send(session, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY)) &&
+             StreamSessions::job_send(session, part_buf, part_len) &&
+             StreamSessions::job_send(session, (const char *)frame->buf, frame->len);
+        if (ok) {
+            StreamSessions::job_count_frame(session, strlen(_STREAM_BOUNDARY) + part_len + frame->len);
+        }
+        CaptureTask::release(frame);
+    }
+
+    if (ok) {
+        StreamSessions::job_send(session, _SWEEP_END, strlen(_SWEEP_END));
+    }
+
+    if (grid->restore) {
+        for (int i = 0; i < grid->axis_count; i++) {
+            sensor_result_t result;
+            apply_sweep_axis(&grid->axes[i], job->original[i], &result);
+        }
+    }
+
+    MemoryManager::buffers().free(job);
+}
+
+esp_err_t WebServer::handle_sweep(httpd_req_t *req) {
+
+    char param[512];
+
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing sweep parameters");
+    }
+
+    // the grid is over a kilobyte, keep it off the httpd stack
+    static_assert(sizeof(sweep_job_t) <= MEM_BUFFER_SIZE, "sweep_job_t must fit in a pool buffer");
+    sweep_job_t *job = (sweep_job_t *)MemoryManager::buffers().alloc();
+    if (!job) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Out of response buffers");
+    }
+    sweep_grid_t *grid = &job->grid;
+
+    const char *err = sweep_grid_parse(param, grid);
+    if (err) {
+        MemoryManager::buffers().free(job);
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+    }
+
+    // check every axis before touching anything, and remember where we started
+    sensor_t *sensor = CameraHal::get_sensor();
+    for (int i = 0; i < grid->axis_count; i++) {
+        if (!read_sweep_axis(sensor, &grid->axes[i], &job->original[i])) {
+            Serial.printf("Sweep: unknown setting or register %s\n", grid->axes[i].key);
+            MemoryManager::buffers().free(job);
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown setting or unreadable register");
+        }
+    }
+
+    Serial.printf("Sweep: %u points over %d axes, settle %d frames\n",
+        grid->points, grid->axis_count, grid->settle);
+
+    // a sweep takes seconds per point, a worker runs it like a stream and frees the job,
+    // so grid is not ours any more once it is admitted
+    if (StreamSessions::admit_job(req, "sweep", run_sweep, &job, sizeof(job)) != ESP_OK) {
+        MemoryManager::buffers().free(job);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_sendstr(req, "Too many streams");
+    }
+    return ESP_OK;
+}
+
+esp_err_t WebServer::handle_histogram(httpd_req_t *req) {
+
+    char param[64];
+    char val[16];
+    bool binary = false;
+
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK) {
+        // ?interval=N sets the shortest time between updates in ms, 0 turns the stage off
+        if (httpd_query_key_value(param, "interval", val, sizeof(val)) == ESP_OK) {
+            ExposureStats::set_interval_ms(atoi(val));
+        }
+        binary = httpd_query_key_value(param, "format", val, sizeof(val)) == ESP_OK && !strcmp(val, "bin");
+    }
+
+    luma_stats_t stats;
+    if (!ExposureStats::latest(&stats)) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "No statistics yet");
+    }
+
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    // binary is the luma_stats_t struct as is, little-endian
+    if (binary) {
+        httpd_resp_set_type(req, "application/octet-stream");
+        return httpd_resp_send(req, (const char *)&stats, sizeof(stats));
+    }
+
+    char *json_response = (char *)MemoryManager::buffers().alloc();
+    if (!json_response) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Out of response buffers");
+    }
+
+    int n = ExposureStats::write_json(json_response, MEM_BUFFER_SIZE, stats);
+
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t res = httpd_resp_send(req, json_response, n);
+    MemoryManager::buffers().free(json_response);
+    return res;
+}
+
+esp_err_t WebServer::handle_integrity(httpd_req_t *req) {
+
+    char param[64];
+    char val[16];
+
+    // ?mode=off|count|drop, without it just report the current mode
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK &&
+        httpd_query_key_value(param, "mode", val, sizeof(val)) == ESP_OK) {
+        if (!strcmp(val, "off")) {
+            FrameCheck::set_mode(FRAME_CHECK_OFF);
+        } else if (!strcmp(val, "count")) {
+            FrameCheck::set_mode(FRAME_CHECK_COUNT);
+        } else if (!strcmp(val, "drop")) {
+            FrameCheck::set_mode(FRAME_CHECK_DROP);
+        } else {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mode must be off, count or drop");
+        }
+    }
+
+    char *json_response = (char *)MemoryManager::buffers().alloc();
+    if (!json_response) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Out of response buffers");
+    }
+
+    size_t n = 0;
+    json_response[n++] = '{';
+    n += FrameCheck::write_metrics(json_response + n, MEM_BUFFER_SIZE - n - 1);
+    json_response[n++] = '}';
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = httpd_resp_send(req, json_response, n);
+    MemoryManager::buffers().free(json_response);
+    return res;
+}
+
+typedef struct {
+    bool delta;
+    uint32_t since;
+    uint8_t *image;
+    size_t len;
+} regdump_request_t;
+
+static int run_regdump(sensor_t *sensor, void *ctx) {
+    regdump_request_t *request = (regdump_request_t *)ctx;
+    request->len = RegDump::snapshot(sensor, request->delta, request->since, request->image, MEM_BUFFER_SIZE);
+    return 0;
+}
+
+esp_err_t WebServer::handle_regdump(httpd_req_t *req) {
+
+    char param[256];
+    char val[192];
+    bool delta = false;
+    uint32_t since = 0;
+
+    sensor_t *sensor = CameraHal::get_sensor();
+
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK) {
+        // ?ranges=0x3500-0x350d,0x3a00-0x3a25 replaces the ranges, ?ranges=default goes back to the PID defaults
+        if (httpd_query_key_value(param, "ranges", val, sizeof(val)) == ESP_OK) {
+            if (RegDump::configure(sensor, strcmp(val, "default") ? val : NULL) != ESP_OK) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid register ranges");
+            }
+        }
+        // ?since=N only returns registers that changed after sequence N
+        if (httpd_query_key_value(param, "since", val, sizeof(val)) == ESP_OK) {
+            delta = true;
+            since = strtoul(val, NULL, 0);
+        }
+    }
+
+    uint8_t *image = (uint8_t *)MemoryManager::buffers().alloc();
+    if (!image) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Out of response buffers");
+    }
+
+    // the refresh reads every register in the ranges, let the capture task do it between frames
+    regdump_request_t request = { delta, since, image, 0 };
+    sensor_result_t result;
+    esp_err_t err = SensorQueue::call(run_regdump, &request, &result);
+    if (err != ESP_OK) {
+        MemoryManager::buffers().free(image);
+        return send_queue_error(req, err);
+    }
+    size_t len = request.len;
+    if (len == 0) {
+        MemoryManager::buffers().free(image);
+        return httpd_resp_send_500(req);
+    }
+
+    // the sequence is also in the binary header, repeat it for clients that only look at headers
+    regdump_header_t hdr;
+    memcpy(&hdr, image, sizeof(hdr));
+    char seq_header[16];
+    snprintf(seq_header, sizeof(seq_header), "%u", hdr.seq);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "X-Regdump-Seq", seq_header);
+    esp_err_t res = httpd_resp_send(req, (const char *)image, len);
+    MemoryManager::buffers().free(image);
+    return res;
+}
+
+// /raw?format= accepts these names, jpeg switches the camera back to normal operation
+static const struct {
+    const char *name;
+    pixformat_t format;
+} raw_formats[] = {
+    { "gray",   PIXFORMAT_GRAYSCALE },
+    { "yuv422", PIXFORMAT_YUV422 },
+    { "rgb565", PIXFORMAT_RGB565 },
+    { "jpeg",   PIXFORMAT_JPEG },
+};
+
+static const char *raw_format_name(pixformat_t format) {
+    for (size_t i = 0; i < sizeof(raw_formats) / sizeof(raw_formats[0]); i++) {
+        if (raw_formats[i].format == format) {
+            return raw_formats[i].name;
+        }
+    }
+    return "unknown";
+}
+
+// Runs on a stream worker: send raw frames until the count (0 for no limit) or the client runs out
+static void run_raw(stream_session_t *session, void *arg) {
+    uint32_t frames = *(uint32_t *)arg;
+
+    if (!StreamSessions::job_begin(session, "application/octet-stream")) {
+        return;
+    }
+
+    uint32_t last_seq = CaptureTask::latest_raw_seq();
+    for (uint32_t sent = 0; frames == 0 || sent < frames; sent++) {
+        frame_t *frame = CaptureTask::acquire_next_raw(last_seq, FRAME_TIMEOUT_MS);
+        if (!frame) {
+            Serial.println("Camera raw frame capture failed");
+            return;
+        }
+        last_seq = frame->seq;
+
+        raw_header_t hdr;
+        memcpy(hdr.magic, RAW_HEADER_MAGIC, sizeof(hdr.magic));
+        hdr.version = RAW_HEADER_VERSION;
+        hdr.format = frame->format;
+        hdr.header_len = sizeof(hdr);
+        hdr.width = frame->width;
+        hdr.height = frame->height;
+        hdr.stride = frame->width * frame_bytes_per_pixel(frame->format);
+        hdr.seq = frame->seq;
+        hdr.len = frame->len;
+        hdr.ts_sec = frame->wall.tv_sec;
+        hdr.ts_usec = frame->wall.tv_usec;
+
+        // the pixels go out straight from the driver buffer, no copy on the way
+        bool ok = StreamSessions::job_send(session, (const char *)&hdr, sizeof(hdr)) &&
+                  StreamSessions::job_send(session, (const char *)frame->buf, frame->len);
+        CaptureTask::release(frame);
+        if (!ok) {
+            return;
+        }
+        StreamSessions::job_count_frame(session, sizeof(hdr) + frame->len);
+    }
+}
+
+esp_err_t WebServer::handle_raw(httpd_req_t *req) {
+
+    char param[128];
+    char val[16];
+    pixformat_t format = CameraHal::get_format();
+    framesize_t size = FRAMESIZE_INVALID;
+    uint32_t frames = 0;
+
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK) {
+        if (httpd_query_key_value(param, "format", val, sizeof(val)) == ESP_OK) {
+            size_t i = 0;
+            while (i < sizeof(raw_formats) / sizeof(raw_formats[0]) && strcmp(val, raw_formats[i].name)) {
+                i++;
+            }
+            if (i == sizeof(raw_formats) / sizeof(raw_formats[0])) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "format must be gray, yuv422, rgb565 or jpeg");
+            }
+            format = raw_formats[i].format;
+        }
+        if (httpd_query_key_value(param, "framesize", val, sizeof(val)) == ESP_OK) {
+            // range check the number before it becomes an enum, whose range is up to the compiler
+            int value = atoi(val);
+            if (value < 0 || value >= FRAMESIZE_INVALID) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid framesize");
+            }
+            size = (framesize_t)value;
+        }
+        // ?frames=N stops after N frames, the default keeps streaming
+        if (httpd_query_key_value(param, "frames", val, sizeof(val)) == ESP_OK) {
+            frames = strtoul(val, NULL, 10);
+        }
+    }
+
+    // switched before admission, a 503 below leaves the camera in the new mode for the retry
+    if (format != CameraHal::get_format() || size != FRAMESIZE_INVALID) {
+        esp_err_t err = CameraHal::set_format(format, size);
+        if (err != ESP_OK) {
+            // most likely the frame buffers for this size did not fit, the camera is back in its old mode
+            Serial.printf("Switching to %s failed with error 0x%x\n", raw_format_name(format), err);
+            return httpd_resp_send_500(req);
+        }
+    }
+
+    if (format == PIXFORMAT_JPEG) {
+        char response[64];
+        snprintf(response, sizeof(response), "{\"format\":\"%s\",\"framesize\":%d}",
+            raw_format_name(format), (int)CameraHal::get_sensor()->status.framesize);
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+    }
+
+    // an unbounded raw stream would hold the server task forever, a worker sends it like /stream
+    if (StreamSessions::admit_job(req, "raw", run_raw, &frames, sizeof(frames)) != ESP_OK) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_sendstr(req, "Too many streams");
+    }
+    return ESP_OK;
+}
+
+// Parse "seconds[.fraction]" into a timeval without going through a double
+static bool parse_wall_time(const char *text, struct timeval *tv) {
+    char *end;
+    long long sec = strtoll(text, &end, 10);
+    if (end == text || sec < 0) {
+        return false;
+    }
+    long usec = 0;
+    if (*end == '.') {
+        long scale = 100000;
+        for (end++; *end >= '0' && *end <= '9'; end++) {
+            usec += (*end - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (*end) {
+        return false;
+    }
+    tv->tv_sec = sec;
+    tv->tv_usec = usec;
+    return true;
+}
+
+esp_err_t WebServer::handle_frame(httpd_req_t *req) {
+
+    char param[128];
+    char val[32];
+    uint32_t after = CaptureTask::latest_seq();
+    bool by_time = false;
+    struct timeval at = {};
+    uint32_t timeout = FRAME_TIMEOUT_MS;
+
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK) {
+        // ?after=N is the oldest frame still in the history that is newer than N
+        if (httpd_query_key_value(param, "after", val, sizeof(val)) == ESP_OK) {
+            after = strtoul(val, NULL, 10);
+        }
+        // ?at=1700000000.250 is the frame captured closest to that wall clock time
+        if (httpd_query_key_value(param, "at", val, sizeof(val)) == ESP_OK) {
+            if (!parse_wall_time(val, &at)) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "at must be seconds[.fraction] since the epoch");
+            }
+            by_time = true;
+        }
+        if (httpd_query_key_value(param, "timeout", val, sizeof(val)) == ESP_OK) {
+            timeout = strtoul(val, NULL, 10);
+            timeout = timeout > FRAME_MAX_TIMEOUT_MS ? FRAME_MAX_TIMEOUT_MS : timeout;
+        }
+    }
+
+    // a frame that is already there goes out right away, a wait is handed to a worker
+    // like /stream, so the server task stays free for other requests. By time a closer
+    // frame may still be coming even when there is one, so that always goes to a worker.
+    int64_t delta_us = 0;
+    frame_t *frame = nullptr;
+    if (by_time && !timeout) {
+        frame = CaptureTask::acquire_nearest(at, 0, &delta_us);
+    } else if (!by_time) {
+        frame = CaptureTask::acquire_after(after, 0);
+    }
+    if (!frame && timeout > 0) {
+        frame_request_t request = {};
+        request.after = after;
+        request.by_time = by_time;
+        request.at = at;
+        request.timeout_ms = timeout;
+        if (StreamSessions::admit_frame(req, request) != ESP_OK) {
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            httpd_resp_set_hdr(req, "Retry-After", "1");
+            return httpd_resp_sendstr(req, "Too many waiting requests");
+        }
+        return ESP_OK;
+    }
+    if (!frame) {
+        // nothing in time, tell the client to poll again rather than treating it as an error
+        httpd_resp_set_status(req, "504 Gateway Timeout");
+        return httpd_resp_sendstr(req, "No frame in time");
+    }
+
+    char ts_header[32];
+    char seq_header[16];
+    char delta_header[24];
+    snprintf(ts_header, sizeof(ts_header), "%lld.%06ld", (long long)frame->wall.tv_sec, (long)frame->wall.tv_usec);
+    snprintf(seq_header, sizeof(seq_header), "%u", frame->seq);
+
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=frame.jpg");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "X-Timestamp", ts_header);
+    httpd_resp_set_hdr(req, "X-Sequence", seq_header);
+    // without an SNTP sync the timestamps count from boot and cannot be compared across cameras
+    httpd_resp_set_hdr(req, "X-Clock-Synced", WallClock::synced() ? "1" : "0");
+    if (by_time) {
+        // how far the frame is from the requested time, negative means before it
+        snprintf(delta_header, sizeof(delta_header), "%lld", (long long)delta_us);
+        httpd_resp_set_hdr(req, "X-Time-Delta-Us", delta_header);
+    }
+
+    esp_err_t res = httpd_resp_send(req, (const char *)frame->buf, frame->len);
+    CaptureTask::release(frame);
+    return res;
+}
+
+static esp_err_t send_timelapse_shot(httpd_req_t *req, int index) {
+    const timelapse_shot_t *shot = TimeLapse::acquire_shot(index);
+    if (!shot) {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such shot");
+    }
+
+    char ts_header[32];
+    char seq_header[16];
+    char wake_header[16];
+    snprintf(ts_header, sizeof(ts_header), "%lld.%06ld", (long long)shot->wall.tv_sec, (long)shot->wall.tv_usec);
+    snprintf(seq_header, sizeof(seq_header), "%u", shot->seq);
+    snprintf(wake_header, sizeof(wake_header), "%u", shot->wake_us);
+
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=shot.jpg");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "X-Timestamp", ts_header);
+    httpd_resp_set_hdr(req, "X-Sequence", seq_header);
+    // from waking the sensor until the shot's capture started
+    httpd_resp_set_hdr(req, "X-Wake-Latency-Us", wake_header);
+    esp_err_t res = httpd_resp_send(req, (const char *)shot->buf, shot->len);
+    TimeLapse::release_shot(shot);
+    return res;
+}
+
+esp_err_t WebServer::handle_timelapse(httpd_req_t *req) {
+    // ?interval=S starts (or restarts) taking a shot every S seconds, warmup=N frames are
+    // dropped after waking, upload=URL posts every shot there. The URL goes in as is, it
+    // must not contain & or %, and " or \ are refused since it is echoed into the JSON.
+    // ?stop=1 stops, ?shot=N returns the Nth latest shot.
+    char param[256];
+    char val[TIMELAPSE_URL_MAX];
+    if (httpd_req_get_url_query_str(req, param, sizeof(param)) == ESP_OK) {
+        if (httpd_query_key_value(param, "shot", val, sizeof(val)) == ESP_OK) {
+            return send_timelapse_shot(req, atoi(val));
+        }
+        if (httpd_query_key_value(param, "stop", val, sizeof(val)) == ESP_OK) {
+            TimeLapse::stop();
+        } else if (httpd_query_key_value(param, "interval", val, sizeof(val)) == ESP_OK) {
+            timelapse_params_t params = {};
+            params.interval_s = strtoul(val, NULL, 10);
+            params.warmup_frames = TIMELAPSE_WARMUP_FRAMES;
+            if (httpd_query_key_value(param, "warmup", val, sizeof(val)) == ESP_OK) {
+                params.warmup_frames = strtoul(val, NULL, 10);
+                if (params.warmup_frames > TIMELAPSE_MAX_WARMUP_FRAMES) {
+                    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "warmup is above TIMELAPSE_MAX_WARMUP_FRAMES");
+                }
+            }
+            if (httpd_query_key_value(param, "upload", val, sizeof(val)) == ESP_OK) {
+                if (strncmp(val, "http://", 7) && strncmp(val, "https://", 8)) {
+                    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "upload must be an http:// or https:// URL");
+                }
+                for (const char *c = val; *c; c++) {
+                    if (*c == '"' || *c == '\\' || (unsigned char)*c < 0x20) {
+                        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "upload must not contain quotes, backslashes or control characters");
+                    }
+                }
+                strcpy(params.upload_url, val);
+            }
+            esp_err_t err = TimeLapse::start(params);
+            if (err == ESP_ERR_INVALID_ARG) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "interval is below TIMELAPSE_MIN_INTERVAL_S");
+            }
+            if (err != ESP_OK) {
+                return httpd_resp_send_500(req);
+            }
+        }
+    }
+
+    char *json_response = (char *)MemoryManager::buffers().alloc();
+    if (!json_response) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Out of response buffers");
+    }
+
+    size_t n = 0;
+    json_response[n++] = '{';
+    n += TimeLapse::write_metrics(json_response + n, MEM_BUFFER_SIZE - n - 1);
+    json_response[n++] = '}';
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = httpd_resp_send(req, json_response, n);
+    MemoryManager::buffers().free(json_response);
+    return res;
+}
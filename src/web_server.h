@@ -11,6 +11,8 @@ class WebServer {
   private:
     static httpd_handle_t server;
     static esp_err_t handle_index(httpd_req_t *req);
+    //hashed control UI assets, see WebUi
+    static esp_err_t handle_ui(httpd_req_t *req);
     static esp_err_t handle_stream(httpd_req_t *req);
     static esp_err_t handle_snapshot(httpd_req_t *req);
     // static means that the function belongs to this class, rather than to any particular instance
@@ -26,7 +28,27 @@ class WebServer {
     //setpll
     static esp_err_t handle_setpll(httpd_req_t *req);
     //setres
-    static esp_err_t handle_setresolution(http_req_t *req);
+    static esp_err_t handle_setresolution(httpd_req_t *req);
+    //memory pool and heap statistics as json
+    static esp_err_t handle_metrics(httpd_req_t *req);
+    //get or set the driver frame buffer count, grab mode and placement
+    static esp_err_t handle_fbconfig(httpd_req_t *req);
+    //capture a burst of frames and report fps and latency
+    static esp_err_t handle_bench(httpd_req_t *req);
+    //run a settings/register grid on the device and stream one frame per point
+    static esp_err_t handle_sweep(httpd_req_t *req);
+    //luma histogram and exposure statistics of a recent frame
+    static esp_err_t handle_histogram(httpd_req_t *req);
+    //get or set the frame integrity check mode
+    static esp_err_t handle_integrity(httpd_req_t *req);
+    //binary register map image, full or changes since a sequence number
+    static esp_err_t handle_regdump(httpd_req_t *req);
+    //switch to a raw pixel format and stream uncompressed frames with a binary header
+    static esp_err_t handle_raw(httpd_req_t *req);
+    //long-poll for the frame after a sequence number or closest to a wall clock time
+    static esp_err_t handle_frame(httpd_req_t *req);
+    //start, stop or inspect the duty-cycled time-lapse and fetch its shots
+    static esp_err_t handle_timelapse(httpd_req_t *req);
 };
 
 #endif
@@ -0,0 +1,51 @@
+#include <string.h>
+#include <atomic>
+#include "web_ui.h"
+#include "web_assets.h"
+
+static std::atomic<uint32_t> served(0);
+static std::atomic<uint32_t> not_modified(0);
+static std::atomic<uint32_t> bytes_sent(0);
+
+//public
+
+const web_asset_t *WebUi::find(const char *uri) {
+    // the query string plays no part in which file is meant
+    size_t len = strcspn(uri, "?");
+    for (size_t i = 0; i < sizeof(web_assets) / sizeof(web_assets[0]); i++) {
+        if (strlen(web_assets[i].uri) == len && !strncmp(web_assets[i].uri, uri, len)) {
+            return &web_assets[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t WebUi::send(httpd_req_t *req, const web_asset_t *asset) {
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+    httpd_resp_set_hdr(req, "Cache-Control", asset->immutable ? "public, max-age=31536000, immutable" : "no-cache");
+
+    char etag[24];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", etag, sizeof(etag)) == ESP_OK &&
+        !strcmp(etag, asset->etag)) {
+        not_modified++;
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    // every browser that can run the UI takes gzip, so there is no uncompressed copy to fall back to
+    httpd_resp_set_type(req, asset->content_type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    served++;
+    bytes_sent += asset->len;
+    return httpd_resp_send(req, (const char *)asset->data, asset->len);
+}
+
+int WebUi::write_metrics(char *out, size_t len) {
+    size_t total = 0;
+    for (size_t i = 0; i < sizeof(web_assets) / sizeof(web_assets[0]); i++) {
+        total += web_assets[i].len;
+    }
+    return snprintf(out, len, "\"ui\":{\"assets\":%u,\"embedded_bytes\":%u,\"served\":%u,\"not_modified\":%u,\"bytes\":%u}",
+        (unsigned)(sizeof(web_assets) / sizeof(web_assets[0])), (unsigned)total,
+        served.load(), not_modified.load(), bytes_sent.load());
+}
@@ -0,0 +1,32 @@
+#ifndef WEB_UI_H
+#define WEB_UI_H
+
+#include <Arduino.h>
+#include <esp_http_server.h>
+
+// One file of the control UI, already minified and gzipped by tools/embed_web.py
+typedef struct {
+    const char *uri;           // "/" for index.html, "/ui/<name>.<hash>.<ext>" for the rest
+    const char *content_type;
+    const uint8_t *data;       // gzip stream in flash
+    size_t len;
+    const char *etag;          // quoted content hash
+    bool immutable;            // the URI changes with the content, browsers may keep it forever
+} web_asset_t;
+
+// Serves the control UI in web/ straight out of flash. Everything goes out gzipped as
+// it was embedded, nothing is copied or compressed at runtime. Hashed assets are cached
+// for a year, index.html is revalidated with its ETag, so after the first visit a
+// reload costs one 304 and the stream keeps the radio to itself.
+class WebUi {
+  public:
+    // The embedded asset for a request URI, NULL if there is none
+    static const web_asset_t *find(const char *uri);
+    // Send asset, or 304 if the client already has this version
+    static esp_err_t send(httpd_req_t *req, const web_asset_t *asset);
+
+    // Write the "ui" member of the /metrics JSON object
+    static int write_metrics(char *out, size_t len);
+};
+
+#endif // WEB_UI_H
@@ -0,0 +1,97 @@
+// Host tests for the JPEG frame checks: pio test -e native
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jpeg_check.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static long brute_force_eoi(const uint8_t *buf, size_t len) {
+    for (long i = (long)len - 2; i >= 0; i--) {
+        if (buf[i] == 0xFF && buf[i + 1] == 0xD9) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void test_find_eoi_matches_brute_force(void) {
+    static uint8_t buf[256 + 4];
+    srand(1);
+    for (int round = 0; round < 20000; round++) {
+        // every alignment of the start and every length, with FF and D9 dense enough to collide
+        size_t offset = rand() % 4;
+        size_t len = rand() % 256;
+        uint8_t *p = buf + offset;
+        for (size_t i = 0; i < len; i++) {
+            int r = rand() % 8;
+            p[i] = r == 0 ? 0xFF : r == 1 ? 0xD9 : (uint8_t)rand();
+        }
+        TEST_ASSERT_EQUAL(brute_force_eoi(p, len), jpeg_find_eoi(p, len));
+    }
+}
+
+static void test_find_eoi_edges(void) {
+    static const uint8_t only[] = { 0xFF, 0xD9 };
+    TEST_ASSERT_EQUAL(0, jpeg_find_eoi(only, 2));
+    TEST_ASSERT_EQUAL(-1, jpeg_find_eoi(only, 1));
+    TEST_ASSERT_EQUAL(-1, jpeg_find_eoi(only, 0));
+
+    // reversed bytes and a lone FF at the very end are not a marker
+    static const uint8_t reversed[] = { 0xD9, 0xFF, 0x00, 0xFF };
+    TEST_ASSERT_EQUAL(-1, jpeg_find_eoi(reversed, sizeof(reversed)));
+
+    // an FF FF D9 run, the marker is the last FF
+    static const uint8_t run[] = { 0x00, 0xFF, 0xFF, 0xD9, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    TEST_ASSERT_EQUAL(2, jpeg_find_eoi(run, sizeof(run)));
+}
+
+static void make_jpeg(uint8_t *buf, size_t len, size_t eoi_at) {
+    memset(buf, 0x55, len);
+    buf[0] = 0xFF;
+    buf[1] = 0xD8;
+    buf[2] = 0xFF;
+    buf[eoi_at] = 0xFF;
+    buf[eoi_at + 1] = 0xD9;
+}
+
+static void test_check(void) {
+    static uint8_t buf[8192];
+    size_t data_len = 0;
+
+    // padding after the EOI is cut off
+    make_jpeg(buf, 4096, 4000);
+    TEST_ASSERT_EQUAL(JPEG_CHECK_OK, jpeg_check(buf, 4096, 0, &data_len));
+    TEST_ASSERT_EQUAL(4002, data_len);
+
+    TEST_ASSERT_EQUAL(JPEG_CHECK_TOO_SHORT, jpeg_check(buf, JPEG_MIN_LEN - 1, 0, NULL));
+    TEST_ASSERT_EQUAL(JPEG_CHECK_TOO_LONG, jpeg_check(buf, 4096, 4095, NULL));
+
+    buf[1] = 0xD9;
+    TEST_ASSERT_EQUAL(JPEG_CHECK_NO_SOI, jpeg_check(buf, 4096, 0, NULL));
+
+    // an EOI further back than the window counts as truncated
+    make_jpeg(buf, 8192, 8192 - JPEG_EOI_WINDOW - 2);
+    TEST_ASSERT_EQUAL(JPEG_CHECK_NO_EOI, jpeg_check(buf, 8192, 0, NULL));
+
+    // a frame shorter than the window is searched whole
+    make_jpeg(buf, 300, 10);
+    TEST_ASSERT_EQUAL(JPEG_CHECK_OK, jpeg_check(buf, 300, 0, &data_len));
+    TEST_ASSERT_EQUAL(12, data_len);
+}
+
+static void test_names(void) {
+    for (int i = 0; i < JPEG_CHECK_CAUSES; i++) {
+        TEST_ASSERT_NOT_EQUAL(0, strcmp("unknown", jpeg_check_name((jpeg_check_t)i)));
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_find_eoi_matches_brute_force);
+    RUN_TEST(test_find_eoi_edges);
+    RUN_TEST(test_check);
+    RUN_TEST(test_names);
+    return UNITY_END();
+}
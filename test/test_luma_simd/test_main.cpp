@@ -0,0 +1,105 @@
+// On-target tests for the ESP32-S3 vector luma path: pio test -e calicam_test
+// Needs a board on the serial port, the vector unit has no host emulation.
+#include <Arduino.h>
+#include <unity.h>
+#include <stdlib.h>
+#include "luma_stats.h"
+#include "luma_simd.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+#if LUMA_SIMD
+
+// the kernel in C, what the vector unit must produce bit for bit
+static int luma_vector_formula(uint8_t high, uint8_t low) {
+    return (315 * (high >> 3) + 2432 * (high & 0x07) + 304 * (low >> 5) + 120 * (low & 0x1F) + 64) >> 7;
+}
+
+// random rows in an oversized buffer, at an odd offset so the copy into the aligned buffer is exercised
+static void check_width(int width) {
+    static uint8_t buffer[LUMA_SIMD_MAX_WIDTH * 2 + 32];
+    for (int round = 0; round < 20; round++) {
+        for (size_t i = 0; i < sizeof(buffer); i++) {
+            buffer[i] = esp_random() & 0xFF;
+        }
+        const uint8_t *row = buffer + 1 + (round & 7);
+
+        const uint16_t *converted = luma_simd_rgb565_be(row, width);
+        TEST_ASSERT_NOT_NULL(converted);
+        for (int x = 0; x < width; x++) {
+            uint8_t high = row[2 * x];
+            uint8_t low = row[2 * x + 1];
+            TEST_ASSERT_EQUAL(luma_vector_formula(high, low), converted[x]);
+            TEST_ASSERT_UINT32_WITHIN(1, luma_rgb565_be(high, low), converted[x]);
+        }
+    }
+}
+
+static void test_widths_not_a_multiple_of_8(void) {
+    const int widths[] = { 1, 3, 7, 9, 15, 17, 100, 161, 319 };
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        check_width(widths[i]);
+    }
+}
+
+static void test_widths_a_multiple_of_8(void) {
+    check_width(8);
+    check_width(160);
+    check_width(LUMA_SIMD_MAX_WIDTH);
+}
+
+static void test_extremes(void) {
+    uint8_t row[16];
+    for (int i = 0; i < 8; i++) {
+        row[2 * i] = i & 1 ? 0xFF : 0x00;
+        row[2 * i + 1] = i & 1 ? 0xFF : 0x00;
+    }
+    const uint16_t *converted = luma_simd_rgb565_be(row, 8);
+    for (int x = 0; x < 8; x++) {
+        TEST_ASSERT_EQUAL(x & 1 ? 255 : 0, converted[x]);
+    }
+}
+
+static void test_rejects_bad_widths(void) {
+    static uint8_t row[(LUMA_SIMD_MAX_WIDTH + 1) * 2];
+    TEST_ASSERT_NULL(luma_simd_rgb565_be(row, 0));
+    TEST_ASSERT_NULL(luma_simd_rgb565_be(row, LUMA_SIMD_MAX_WIDTH + 1));
+}
+
+static void test_stats_match_the_scalar_path(void) {
+    // step 1 goes through the vector unit, the mean has to agree with the tables to within a level
+    const int width = 37;
+    const int height = 9;
+    static uint8_t image[width * height * 2];
+    uint32_t sum = 0;
+    for (int i = 0; i < width * height; i++) {
+        image[2 * i] = esp_random() & 0xFF;
+        image[2 * i + 1] = esp_random() & 0xFF;
+        sum += luma_rgb565_be(image[2 * i], image[2 * i + 1]);
+    }
+
+    luma_stats_t stats;
+    stats.seq = 0;
+    luma_stats_compute(image, width, height, width * 2, LUMA_FMT_RGB565_BE, 1, &stats);
+    TEST_ASSERT_EQUAL(width * height, stats.pixels);
+    TEST_ASSERT_UINT32_WITHIN(100, sum * 100 / (width * height), stats.mean_x100);
+}
+
+#endif
+
+void setup() {
+    // give the serial monitor time to attach
+    delay(2000);
+    UNITY_BEGIN();
+#if LUMA_SIMD
+    RUN_TEST(test_widths_not_a_multiple_of_8);
+    RUN_TEST(test_widths_a_multiple_of_8);
+    RUN_TEST(test_extremes);
+    RUN_TEST(test_rejects_bad_widths);
+    RUN_TEST(test_stats_match_the_scalar_path);
+#endif
+    UNITY_END();
+}
+
+void loop() {}
@@ -0,0 +1,135 @@
+// Host tests for the luma statistics and their RGB565 tables: pio test -e native
+#include <unity.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "luma_stats.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// the integer kernel luma_simd.cpp runs on the S3, written out in C
+static int luma_vector_formula(uint8_t high, uint8_t low) {
+    int r = high >> 3;
+    int g_high = high & 0x07;
+    int g_low = low >> 5;
+    int b = low & 0x1F;
+    return (315 * r + 2432 * g_high + 304 * g_low + 120 * b + 64) >> 7;
+}
+
+static void test_tables_match_bt601(void) {
+    int worst = 0;
+    for (int high = 0; high < 256; high++) {
+        for (int low = 0; low < 256; low++) {
+            int r = high >> 3;
+            int g = (high & 0x07) << 3 | low >> 5;
+            int b = low & 0x1F;
+            double y = 0.299 * r * 255 / 31 + 0.587 * g * 255 / 63 + 0.114 * b * 255 / 31;
+            int diff = abs(luma_rgb565_be(high, low) - (int)lround(y));
+            if (diff > worst) worst = diff;
+        }
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(1, worst);
+    TEST_ASSERT_EQUAL(0, luma_rgb565_be(0x00, 0x00));
+    TEST_ASSERT_EQUAL(255, luma_rgb565_be(0xFF, 0xFF));
+}
+
+static void test_vector_formula_matches_tables(void) {
+    int worst = 0;
+    for (int high = 0; high < 256; high++) {
+        for (int low = 0; low < 256; low++) {
+            int y = luma_vector_formula(high, low);
+            TEST_ASSERT_LESS_OR_EQUAL(255, y);
+            int diff = abs(luma_rgb565_be(high, low) - y);
+            if (diff > worst) worst = diff;
+        }
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(1, worst);
+}
+
+static void test_rgb565_stats_use_the_tables(void) {
+    // odd width, so the zones are uneven and nothing lines up on 8 pixels
+    const int width = 13;
+    const int height = 5;
+    uint8_t image[width * height * 2];
+    uint32_t sum = 0;
+    srand(565);
+    for (int i = 0; i < width * height; i++) {
+        image[2 * i] = rand() & 0xFF;
+        image[2 * i + 1] = rand() & 0xFF;
+        sum += luma_rgb565_be(image[2 * i], image[2 * i + 1]);
+    }
+
+    luma_stats_t stats;
+    stats.seq = 7;
+    luma_stats_compute(image, width, height, width * 2, LUMA_FMT_RGB565_BE, 1, &stats);
+    TEST_ASSERT_EQUAL(7, stats.seq);
+    TEST_ASSERT_EQUAL(width * height, stats.pixels);
+    TEST_ASSERT_EQUAL(sum * 100 / (width * height), stats.mean_x100);
+}
+
+static void test_gray_histogram_and_clipping(void) {
+    uint8_t image[100];
+    for (int i = 0; i < 100; i++) {
+        image[i] = i < 10 ? 0 : i < 30 ? 255 : 128;
+    }
+
+    luma_stats_t stats;
+    stats.seq = 0;
+    luma_stats_compute(image, 10, 10, 10, LUMA_FMT_GRAY, 1, &stats);
+    TEST_ASSERT_EQUAL(100, stats.pixels);
+    TEST_ASSERT_EQUAL(10, stats.hist[0]);
+    TEST_ASSERT_EQUAL(70, stats.hist[128 * LUMA_BINS / 256]);
+    TEST_ASSERT_EQUAL(20, stats.hist[LUMA_BINS - 1]);
+    TEST_ASSERT_EQUAL(100, stats.clip_low_permille);
+    TEST_ASSERT_EQUAL(200, stats.clip_high_permille);
+    TEST_ASSERT_EQUAL((20 * 255 + 70 * 128) * 100 / 100, stats.mean_x100);
+}
+
+static void test_yuyv_uses_only_luma(void) {
+    // Y U Y V, chroma set to values that would show up if it were sampled
+    uint8_t image[4 * 4 * 2];
+    for (int i = 0; i < 4 * 4; i++) {
+        image[2 * i] = 40;
+        image[2 * i + 1] = 250;
+    }
+
+    luma_stats_t stats;
+    stats.seq = 0;
+    luma_stats_compute(image, 4, 4, 8, LUMA_FMT_YUYV, 1, &stats);
+    TEST_ASSERT_EQUAL(16, stats.pixels);
+    TEST_ASSERT_EQUAL(4000, stats.mean_x100);
+    TEST_ASSERT_EQUAL(0, stats.clip_high_permille);
+}
+
+static void test_zones_and_step(void) {
+    // left half dark, right half bright, 8x8
+    uint8_t image[64];
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            image[y * 8 + x] = x < 4 ? 20 : 200;
+        }
+    }
+
+    luma_stats_t stats;
+    stats.seq = 0;
+    luma_stats_compute(image, 8, 8, 8, LUMA_FMT_GRAY, 2, &stats);
+    TEST_ASSERT_EQUAL(16, stats.pixels);
+    for (int zy = 0; zy < LUMA_ZONES_Y; zy++) {
+        TEST_ASSERT_EQUAL(20, stats.zones[zy][0]);
+        TEST_ASSERT_EQUAL(20, stats.zones[zy][1]);
+        TEST_ASSERT_EQUAL(200, stats.zones[zy][2]);
+        TEST_ASSERT_EQUAL(200, stats.zones[zy][3]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_tables_match_bt601);
+    RUN_TEST(test_vector_formula_matches_tables);
+    RUN_TEST(test_rgb565_stats_use_the_tables);
+    RUN_TEST(test_gray_histogram_and_clipping);
+    RUN_TEST(test_yuyv_uses_only_luma);
+    RUN_TEST(test_zones_and_step);
+    return UNITY_END();
+}
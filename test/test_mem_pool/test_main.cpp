@@ -0,0 +1,183 @@
+// Host tests for the slab pools and the frame arena: pio test -e native
+#include <unity.h>
+#include <string.h>
+#include "mem_pool.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_slab_exhaustion(void) {
+    SlabPool pool;
+    TEST_ASSERT_TRUE(pool.init(32, 4, MEM_REGION_INTERNAL));
+
+    void *blocks[4];
+    for (int i = 0; i < 4; i++) {
+        blocks[i] = pool.alloc();
+        TEST_ASSERT_NOT_NULL(blocks[i]);
+        TEST_ASSERT_TRUE(pool.owns(blocks[i]));
+    }
+    TEST_ASSERT_NULL(pool.alloc());
+
+    mem_stats_t s = pool.stats();
+    TEST_ASSERT_EQUAL(4 * 32, s.in_use);
+    TEST_ASSERT_EQUAL(0, s.largest_free);
+    TEST_ASSERT_EQUAL(4, s.allocs);
+    TEST_ASSERT_EQUAL(1, s.failures);
+
+    // a released block is the next one handed out
+    pool.free(blocks[2]);
+    TEST_ASSERT_EQUAL_PTR(blocks[2], pool.alloc());
+    TEST_ASSERT_EQUAL(4 * 32, pool.stats().high_water);
+}
+
+static void test_slab_double_free(void) {
+    SlabPool pool;
+    TEST_ASSERT_TRUE(pool.init(16, 3, MEM_REGION_INTERNAL));
+
+    void *a = pool.alloc();
+    pool.free(a);
+    pool.free(a);
+    mem_stats_t s = pool.stats();
+    TEST_ASSERT_EQUAL(1, s.bad_frees);
+    TEST_ASSERT_EQUAL(0, s.in_use);
+
+    // the block went onto the free list once, so three allocations get three blocks
+    void *x = pool.alloc();
+    void *y = pool.alloc();
+    void *z = pool.alloc();
+    TEST_ASSERT_NOT_NULL(z);
+    TEST_ASSERT_TRUE(x != y && y != z && x != z);
+    TEST_ASSERT_NULL(pool.alloc());
+}
+
+static void test_slab_foreign_pointers(void) {
+    SlabPool pool;
+    TEST_ASSERT_TRUE(pool.init(16, 2, MEM_REGION_INTERNAL));
+
+    uint8_t *a = (uint8_t *)pool.alloc();
+    int outside = 0;
+    TEST_ASSERT_FALSE(pool.owns(&outside));
+    TEST_ASSERT_FALSE(pool.owns(a + 1));
+    pool.free(&outside);
+    pool.free(a + 1);
+    TEST_ASSERT_EQUAL(16, pool.stats().in_use);
+}
+
+static void test_arena_exhaustion(void) {
+    FrameArena arena;
+    TEST_ASSERT_TRUE(arena.init(256, MEM_REGION_INTERNAL));
+
+    // 64 bytes of payload plus an 8 byte header each, three fit into 256
+    void *a = arena.alloc(64);
+    void *b = arena.alloc(64);
+    void *c = arena.alloc(64);
+    TEST_ASSERT_NOT_NULL(c);
+    TEST_ASSERT_NULL(arena.alloc(64));
+    TEST_ASSERT_NOT_NULL(arena.alloc(16));
+
+    mem_stats_t s = arena.stats();
+    TEST_ASSERT_EQUAL(1, s.failures);
+    // 16 bytes are left at the end, minus the header of whatever goes there
+    TEST_ASSERT_EQUAL(8, s.largest_free);
+
+    arena.free(a);
+    arena.free(b);
+    arena.free(c);
+    TEST_ASSERT_GREATER_THAN(0, arena.stats().in_use);
+    TEST_ASSERT_NULL(arena.alloc(300));
+}
+
+static void test_arena_ring_wrap(void) {
+    FrameArena arena;
+    TEST_ASSERT_TRUE(arena.init(256, MEM_REGION_INTERNAL));
+
+    void *a = arena.alloc(64);
+    void *b = arena.alloc(64);
+    void *c = arena.alloc(64);
+    arena.free(a);
+    arena.free(b);
+
+    // only 40 bytes are left before the end, the next block wraps to the front
+    void *d = arena.alloc(64);
+    TEST_ASSERT_EQUAL_PTR(a, d);
+    TEST_ASSERT_TRUE(arena.owns(d));
+
+    // the padding at the end goes away with the block before it
+    arena.free(c);
+    arena.free(d);
+    mem_stats_t s = arena.stats();
+    TEST_ASSERT_EQUAL(0, s.in_use);
+    TEST_ASSERT_EQUAL(0, s.stranded);
+    TEST_ASSERT_EQUAL(256 - 8, s.largest_free);
+}
+
+static void test_arena_out_of_order_release(void) {
+    FrameArena arena;
+    TEST_ASSERT_TRUE(arena.init(256, MEM_REGION_INTERNAL));
+
+    void *a = arena.alloc(64);
+    void *b = arena.alloc(64);
+    void *c = arena.alloc(64);
+
+    // b is released but a still holds the tail, so b's space is stranded
+    arena.free(b);
+    mem_stats_t s = arena.stats();
+    TEST_ASSERT_EQUAL(72, s.stranded);
+    TEST_ASSERT_EQUAL(2 * 72, s.in_use);
+    TEST_ASSERT_NULL(arena.alloc(64));
+
+    // releasing a reclaims both
+    arena.free(a);
+    s = arena.stats();
+    TEST_ASSERT_EQUAL(0, s.stranded);
+    TEST_ASSERT_EQUAL(72, s.in_use);
+    TEST_ASSERT_NOT_NULL(arena.alloc(64));
+
+    // a second release of the same block is ignored
+    arena.free(b);
+    TEST_ASSERT_EQUAL(1, arena.stats().bad_frees);
+    (void)c;
+}
+
+static void test_arena_bad_pointers(void) {
+    FrameArena arena;
+    TEST_ASSERT_TRUE(arena.init(256, MEM_REGION_INTERNAL));
+
+    uint8_t *a = (uint8_t *)arena.alloc(64);
+    uint8_t *b = (uint8_t *)arena.alloc(64);
+    // frame data that looks like a live header must not be taken for one
+    memset(a, 0, 64);
+    ((uint32_t *)a)[4] = 8;
+    ((uint32_t *)a)[5] = 1;
+
+    // into a payload, aligned or not, and into the free space past head
+    arena.free(a + 24);
+    arena.free(a + 3);
+    arena.free(b + 64 + 8);
+    mem_stats_t s = arena.stats();
+    TEST_ASSERT_EQUAL(3, s.bad_frees);
+    TEST_ASSERT_EQUAL(2 * 72, s.in_use);
+
+    // the real blocks still release normally
+    arena.free(b);
+    arena.free(a);
+    s = arena.stats();
+    TEST_ASSERT_EQUAL(3, s.bad_frees);
+    TEST_ASSERT_EQUAL(0, s.in_use);
+
+    // and once reclaimed they are bad frees as well
+    arena.free(a);
+    TEST_ASSERT_EQUAL(4, arena.stats().bad_frees);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_slab_exhaustion);
+    RUN_TEST(test_slab_double_free);
+    RUN_TEST(test_slab_foreign_pointers);
+    RUN_TEST(test_arena_exhaustion);
+    RUN_TEST(test_arena_ring_wrap);
+    RUN_TEST(test_arena_out_of_order_release);
+    RUN_TEST(test_arena_bad_pointers);
+    return UNITY_END();
+}
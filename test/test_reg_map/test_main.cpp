@@ -0,0 +1,179 @@
+// Host tests for the register shadow map and its /regdump encoding: pio test -e native
+#include <unity.h>
+#include <string.h>
+#include "reg_map.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// a fake sensor, registers read back whatever the test put there
+static uint8_t regs[0x10000];
+static int fail_reg = -1;
+
+static int read_fake(void *ctx, uint16_t reg) {
+    (void)ctx;
+    return reg == fail_reg ? -1 : regs[reg];
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+static regdump_header_t header_of(const uint8_t *out) {
+    regdump_header_t hdr;
+    memcpy(&hdr, out, sizeof(hdr));
+    return hdr;
+}
+
+static void test_parse_ranges(void) {
+    reg_range_t r[4];
+    TEST_ASSERT_EQUAL(2, RegisterMap::parse_ranges("0x3000-0x30ff,0x3500", r, 4));
+    TEST_ASSERT_EQUAL(0x3000, r[0].start);
+    TEST_ASSERT_EQUAL(0x100, r[0].count);
+    TEST_ASSERT_EQUAL(0x3500, r[1].start);
+    TEST_ASSERT_EQUAL(1, r[1].count);
+
+    TEST_ASSERT_EQUAL(-1, RegisterMap::parse_ranges("0x30-0x20", r, 4));
+    TEST_ASSERT_EQUAL(-1, RegisterMap::parse_ranges("0x0-0x10000", r, 4));
+    TEST_ASSERT_EQUAL(-1, RegisterMap::parse_ranges("1,2,3,4,5", r, 4));
+    TEST_ASSERT_EQUAL(-1, RegisterMap::parse_ranges("1;2", r, 4));
+    TEST_ASSERT_EQUAL(-1, RegisterMap::parse_ranges("x", r, 4));
+}
+
+static void test_set_ranges_limits(void) {
+    RegisterMap map;
+    reg_range_t too_big[] = { { 0x0000, 0x800 }, { 0x1000, 1 } };
+    TEST_ASSERT_FALSE(map.set_ranges(1, too_big, 2));
+    reg_range_t past_end[] = { { 0xFFFF, 2 } };
+    TEST_ASSERT_FALSE(map.set_ranges(1, past_end, 1));
+    TEST_ASSERT_FALSE(map.set_ranges(1, too_big, 0));
+    TEST_ASSERT_TRUE(map.set_ranges(1, too_big, 1));
+}
+
+static void test_full_image(void) {
+    RegisterMap map;
+    reg_range_t ranges[] = { { 0x3000, 3 }, { 0x3500, 2 } };
+    for (int i = 0; i < 3; i++) regs[0x3000 + i] = 0x10 + i;
+    for (int i = 0; i < 2; i++) regs[0x3500 + i] = 0x20 + i;
+    TEST_ASSERT_TRUE(map.set_ranges(0x5640, ranges, 2));
+    TEST_ASSERT_EQUAL(0, map.refresh(read_fake, NULL));
+
+    uint8_t out[64];
+    size_t need = sizeof(regdump_header_t) + 2 * 4 + 5;
+    TEST_ASSERT_EQUAL(0, map.write_full(out, need - 1));
+    TEST_ASSERT_EQUAL(need, map.write_full(out, sizeof(out)));
+
+    regdump_header_t hdr = header_of(out);
+    TEST_ASSERT_EQUAL(0, memcmp(hdr.magic, "CRD1", 4));
+    TEST_ASSERT_EQUAL(0x5640, hdr.pid);
+    TEST_ASSERT_EQUAL(REGDUMP_KIND_FULL, hdr.kind);
+    TEST_ASSERT_EQUAL(2, hdr.ranges);
+    TEST_ASSERT_EQUAL(5, hdr.count);
+
+    const uint8_t *p = out + sizeof(regdump_header_t);
+    TEST_ASSERT_EQUAL(0x3000, get16(p));
+    TEST_ASSERT_EQUAL(3, get16(p + 2));
+    TEST_ASSERT_EQUAL(0x12, p[6]);
+    p += 4 + 3;
+    TEST_ASSERT_EQUAL(0x3500, get16(p));
+    TEST_ASSERT_EQUAL(0x21, p[5]);
+}
+
+static void test_delta_encoding(void) {
+    RegisterMap map;
+    reg_range_t ranges[] = { { 0x100, 8 }, { 0x200, 8 } };
+    memset(regs, 0, sizeof(regs));
+    TEST_ASSERT_TRUE(map.set_ranges(0x2642, ranges, 2));
+    map.refresh(read_fake, NULL);
+    uint32_t base = map.get_seq();
+
+    uint8_t out[128];
+    // since 0 gives every register
+    size_t n = map.write_delta(0, out, sizeof(out));
+    TEST_ASSERT_EQUAL(sizeof(regdump_header_t) + 16 * 3, n);
+    TEST_ASSERT_EQUAL(16, header_of(out).count);
+
+    // nothing changed since the current sequence
+    n = map.write_delta(base, out, sizeof(out));
+    TEST_ASSERT_EQUAL(sizeof(regdump_header_t), n);
+    TEST_ASSERT_EQUAL(0, header_of(out).count);
+    TEST_ASSERT_EQUAL(REGDUMP_KIND_DELTA, header_of(out).kind);
+
+    // two changes in one refresh share a sequence number
+    regs[0x103] = 0xAA;
+    regs[0x207] = 0xBB;
+    map.refresh(read_fake, NULL);
+    TEST_ASSERT_EQUAL(base + 1, map.get_seq());
+    n = map.write_delta(base, out, sizeof(out));
+    TEST_ASSERT_EQUAL(sizeof(regdump_header_t) + 2 * 3, n);
+    regdump_header_t hdr = header_of(out);
+    TEST_ASSERT_EQUAL(2, hdr.count);
+    TEST_ASSERT_EQUAL(base + 1, hdr.seq);
+    const uint8_t *p = out + sizeof(regdump_header_t);
+    TEST_ASSERT_EQUAL(0x103, get16(p));
+    TEST_ASSERT_EQUAL(0xAA, p[2]);
+    TEST_ASSERT_EQUAL(0x207, get16(p + 3));
+    TEST_ASSERT_EQUAL(0xBB, p[5]);
+
+    // a later change only shows up after its own sequence
+    regs[0x100] = 1;
+    map.refresh(read_fake, NULL);
+    n = map.write_delta(base + 1, out, sizeof(out));
+    TEST_ASSERT_EQUAL(sizeof(regdump_header_t) + 3, n);
+    TEST_ASSERT_EQUAL(1, header_of(out).count);
+    TEST_ASSERT_EQUAL(0x100, get16(out + sizeof(regdump_header_t)));
+}
+
+static void test_delta_since_from_the_future(void) {
+    RegisterMap map;
+    reg_range_t ranges[] = { { 0x10, 4 } };
+    TEST_ASSERT_TRUE(map.set_ranges(1, ranges, 1));
+    map.refresh(read_fake, NULL);
+
+    // a client from before a reboot holds a larger number, it gets everything
+    uint8_t out[64];
+    map.write_delta(map.get_seq() + 100, out, sizeof(out));
+    TEST_ASSERT_EQUAL(4, header_of(out).count);
+}
+
+static void test_delta_too_small(void) {
+    RegisterMap map;
+    reg_range_t ranges[] = { { 0x10, 4 } };
+    TEST_ASSERT_TRUE(map.set_ranges(1, ranges, 1));
+    uint8_t out[64];
+    TEST_ASSERT_EQUAL(0, map.write_delta(0, out, sizeof(regdump_header_t) - 1));
+    TEST_ASSERT_EQUAL(0, map.write_delta(0, out, sizeof(regdump_header_t) + 3 * 4 - 1));
+    TEST_ASSERT_EQUAL(sizeof(regdump_header_t) + 3 * 4, map.write_delta(0, out, sizeof(regdump_header_t) + 3 * 4));
+}
+
+static void test_read_errors_keep_the_old_value(void) {
+    RegisterMap map;
+    reg_range_t ranges[] = { { 0x40, 2 } };
+    regs[0x40] = 7;
+    regs[0x41] = 8;
+    TEST_ASSERT_TRUE(map.set_ranges(1, ranges, 1));
+    map.refresh(read_fake, NULL);
+    uint32_t seq = map.get_seq();
+
+    fail_reg = 0x41;
+    regs[0x41] = 9;
+    TEST_ASSERT_EQUAL(1, map.refresh(read_fake, NULL));
+    fail_reg = -1;
+    TEST_ASSERT_EQUAL(seq, map.get_seq());
+
+    uint8_t out[64];
+    map.write_full(out, sizeof(out));
+    TEST_ASSERT_EQUAL(8, out[sizeof(regdump_header_t) + 4 + 1]);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_ranges);
+    RUN_TEST(test_set_ranges_limits);
+    RUN_TEST(test_full_image);
+    RUN_TEST(test_delta_encoding);
+    RUN_TEST(test_delta_since_from_the_future);
+    RUN_TEST(test_delta_too_small);
+    RUN_TEST(test_read_errors_keep_the_old_value);
+    return UNITY_END();
+}
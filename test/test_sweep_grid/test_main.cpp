@@ -0,0 +1,111 @@
+// Host tests for the /sweep query parser and point enumeration: pio test -e native
+#include <unity.h>
+#include "sweep_grid.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static sweep_grid_t grid;
+
+static void test_range_includes_stop(void) {
+    TEST_ASSERT_NULL(sweep_grid_parse("aec_value=0:1200:100", &grid));
+    TEST_ASSERT_EQUAL(1, grid.axis_count);
+    TEST_ASSERT_EQUAL(SWEEP_AXIS_SETTING, grid.axes[0].kind);
+    TEST_ASSERT_EQUAL(13, grid.axes[0].count);
+    TEST_ASSERT_EQUAL(0, grid.axes[0].values[0]);
+    TEST_ASSERT_EQUAL(1200, grid.axes[0].values[12]);
+    TEST_ASSERT_EQUAL(13, grid.points);
+}
+
+static void test_range_uneven_and_downwards(void) {
+    TEST_ASSERT_NULL(sweep_grid_parse("agc_gain=10:0:-3", &grid));
+    TEST_ASSERT_EQUAL(4, grid.axes[0].count);
+    TEST_ASSERT_EQUAL(10, grid.axes[0].values[0]);
+    TEST_ASSERT_EQUAL(1, grid.axes[0].values[3]);
+
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("agc_gain=0:10:-1", &grid));
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("agc_gain=0:10:0", &grid));
+}
+
+static void test_range_at_int_limits(void) {
+    // the whole int span in a step or two used to wrap the loop counter and run past values[]
+    TEST_ASSERT_NULL(sweep_grid_parse("aec_value=0:2147483647:2147483647", &grid));
+    TEST_ASSERT_EQUAL(2, grid.axes[0].count);
+    TEST_ASSERT_EQUAL(2147483647, grid.axes[0].values[1]);
+
+    TEST_ASSERT_NULL(sweep_grid_parse("aec_value=-2147483648:2147483647:2147483647", &grid));
+    TEST_ASSERT_EQUAL(3, grid.axes[0].count);
+    TEST_ASSERT_EQUAL(2147483646, grid.axes[0].values[2]);
+
+    TEST_ASSERT_NULL(sweep_grid_parse("aec_value=2147483647:-2147483648:-2147483648", &grid));
+    TEST_ASSERT_EQUAL(2, grid.axes[0].count);
+    TEST_ASSERT_EQUAL(-1, grid.axes[0].values[1]);
+
+    // far more values than fit, and values that do not fit an int
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("aec_value=-2147483648:2147483647:1", &grid));
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("aec_value=0:4294967296:1", &grid));
+}
+
+static void test_too_many_values(void) {
+    TEST_ASSERT_NULL(sweep_grid_parse("aec_value=0:63", &grid));
+    TEST_ASSERT_EQUAL(SWEEP_MAX_VALUES, grid.axes[0].count);
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("aec_value=0:64", &grid));
+}
+
+static void test_list_and_registers(void) {
+    TEST_ASSERT_NULL(sweep_grid_parse("0x3503/0x03=0,3&0x3500=1,2,3&settle=5&restore=0", &grid));
+    TEST_ASSERT_EQUAL(2, grid.axis_count);
+    TEST_ASSERT_EQUAL(SWEEP_AXIS_REGISTER, grid.axes[0].kind);
+    TEST_ASSERT_EQUAL(0x3503, grid.axes[0].reg);
+    TEST_ASSERT_EQUAL(0x03, grid.axes[0].mask);
+    TEST_ASSERT_EQUAL(0xFF, grid.axes[1].mask);
+    TEST_ASSERT_EQUAL(5, grid.settle);
+    TEST_ASSERT_FALSE(grid.restore);
+    TEST_ASSERT_EQUAL(6, grid.points);
+}
+
+static void test_encoded_separators(void) {
+    TEST_ASSERT_NULL(sweep_grid_parse("agc_gain=0%3A4%3A2&0x3503%2F0x03=1%2C2", &grid));
+    TEST_ASSERT_EQUAL(3, grid.axes[0].count);
+    TEST_ASSERT_EQUAL(2, grid.axes[1].count);
+    TEST_ASSERT_EQUAL(3, grid.axes[1].mask);
+}
+
+static void test_bad_queries(void) {
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("", &grid));
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("settle=2", &grid));
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("settle=31&a=1", &grid));
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("Bad=1", &grid));
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("a=1,x", &grid));
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("a", &grid));
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("a=1&b=1&c=1&d=1&e=1", &grid));
+    // 64 * 64 * 64 points
+    TEST_ASSERT_NOT_NULL(sweep_grid_parse("a=0:63&b=0:63&c=0:63", &grid));
+}
+
+static void test_point_enumeration(void) {
+    TEST_ASSERT_NULL(sweep_grid_parse("a=1,2&b=10,20,30", &grid));
+    TEST_ASSERT_EQUAL(6, grid.points);
+
+    // last axis varies fastest
+    static const int expected[6][2] = { {1, 10}, {1, 20}, {1, 30}, {2, 10}, {2, 20}, {2, 30} };
+    for (uint32_t n = 0; n < grid.points; n++) {
+        int values[SWEEP_MAX_AXES];
+        sweep_grid_point(&grid, n, values);
+        TEST_ASSERT_EQUAL(expected[n][0], values[0]);
+        TEST_ASSERT_EQUAL(expected[n][1], values[1]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_range_includes_stop);
+    RUN_TEST(test_range_uneven_and_downwards);
+    RUN_TEST(test_range_at_int_limits);
+    RUN_TEST(test_too_many_values);
+    RUN_TEST(test_list_and_registers);
+    RUN_TEST(test_encoded_separators);
+    RUN_TEST(test_bad_queries);
+    RUN_TEST(test_point_enumeration);
+    return UNITY_END();
+}
@@ -0,0 +1,119 @@
+// Host tests for the time-lapse schedule with a simulated clock: pio test -e native
+#include <unity.h>
+#include "timelapse_schedule.h"
+
+#define INTERVAL_US 60000000LL
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Sleep as told, wake, keep a frame latency_us later and finish busy_us after that
+static int64_t take_shot(timelapse_schedule_t *s, int64_t now, int64_t latency_us, int64_t busy_us) {
+    now += timelapse_schedule_sleep_us(s, now);
+    int64_t wake = now;
+    int64_t frame = wake + latency_us;
+    now = frame + busy_us;
+    timelapse_schedule_done(s, wake, frame, now);
+    return now;
+}
+
+static void test_first_shot_right_away(void) {
+    timelapse_schedule_t s;
+    timelapse_schedule_init(&s, INTERVAL_US, 1000);
+    TEST_ASSERT_EQUAL(0, timelapse_schedule_sleep_us(&s, 1000));
+    TEST_ASSERT_EQUAL(0, s.lead_us);
+}
+
+static void test_frames_stay_on_the_grid(void) {
+    timelapse_schedule_t s;
+    int64_t start = 1000;
+    timelapse_schedule_init(&s, INTERVAL_US, start);
+
+    int64_t now = start;
+    for (int i = 0; i < 100; i++) {
+        // from the third shot on the lead is learned, so the kept frame lands on its due time
+        now += timelapse_schedule_sleep_us(&s, now);
+        int64_t frame = now + 400000;
+        if (i >= 2) {
+            TEST_ASSERT_EQUAL(s.next_us, frame);
+        }
+        timelapse_schedule_done(&s, now, frame, frame + 50000);
+        now = frame + 50000;
+    }
+    TEST_ASSERT_EQUAL(100, s.shots);
+    TEST_ASSERT_EQUAL(0, s.skipped);
+    TEST_ASSERT_EQUAL(400000, s.lead_us);
+    // a hundred shots later the grid has not drifted by a microsecond
+    TEST_ASSERT_EQUAL(start + 100 * INTERVAL_US, s.next_us);
+}
+
+static void test_overrun_skips_slots(void) {
+    timelapse_schedule_t s;
+    timelapse_schedule_init(&s, INTERVAL_US, 0);
+    int64_t now = take_shot(&s, 0, 300000, 0);
+
+    // a shot, upload included, that runs through the next two due times
+    now += timelapse_schedule_sleep_us(&s, now);
+    int64_t wake = now;
+    now += 2 * INTERVAL_US + 400000;
+    timelapse_schedule_done(&s, wake, wake + 300000, now);
+
+    TEST_ASSERT_EQUAL(2, s.skipped);
+    TEST_ASSERT_EQUAL(4 * INTERVAL_US, s.next_us);
+    TEST_ASSERT_GREATER_THAN(now, s.next_us);
+}
+
+static void test_finish_on_due_time_skips_it(void) {
+    timelapse_schedule_t s;
+    timelapse_schedule_init(&s, INTERVAL_US, 0);
+    timelapse_schedule_done(&s, 0, 0, INTERVAL_US);
+    TEST_ASSERT_EQUAL(1, s.skipped);
+    TEST_ASSERT_EQUAL(2 * INTERVAL_US, s.next_us);
+}
+
+static void test_lead_jumps_up_and_creeps_down(void) {
+    timelapse_schedule_t s;
+    timelapse_schedule_init(&s, INTERVAL_US, 0);
+    int64_t now = take_shot(&s, 0, 400000, 0);
+    TEST_ASSERT_EQUAL(400000, s.lead_us);
+
+    // a slower wake is followed straight away
+    now = take_shot(&s, now, 1000000, 0);
+    TEST_ASSERT_EQUAL(1000000, s.lead_us);
+
+    // a faster one only takes a quarter of the difference per shot
+    now = take_shot(&s, now, 200000, 0);
+    TEST_ASSERT_EQUAL(800000, s.lead_us);
+    for (int i = 0; i < 50; i++) {
+        now = take_shot(&s, now, 200000, 0);
+    }
+    TEST_ASSERT_INT64_WITHIN(4, 200000, s.lead_us);
+    TEST_ASSERT_EQUAL(0, s.skipped);
+}
+
+static void test_lead_capped_at_half_interval(void) {
+    timelapse_schedule_t s;
+    timelapse_schedule_init(&s, 1000, 0);
+    timelapse_schedule_done(&s, 0, 5000, 5000);
+    TEST_ASSERT_EQUAL(500, s.lead_us);
+}
+
+static void test_frame_before_wake_counts_as_no_latency(void) {
+    timelapse_schedule_t s;
+    timelapse_schedule_init(&s, INTERVAL_US, 0);
+    take_shot(&s, 0, 400000, 0);
+    timelapse_schedule_done(&s, 1000, 500, 2000);
+    TEST_ASSERT_EQUAL(300000, s.lead_us);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_shot_right_away);
+    RUN_TEST(test_frames_stay_on_the_grid);
+    RUN_TEST(test_overrun_skips_slots);
+    RUN_TEST(test_finish_on_due_time_skips_it);
+    RUN_TEST(test_lead_jumps_up_and_creeps_down);
+    RUN_TEST(test_lead_capped_at_half_interval);
+    RUN_TEST(test_frame_before_wake_counts_as_no_latency);
+    return UNITY_END();
+}
@@ -0,0 +1,106 @@
+// Host tests for the stream pacing token bucket: pio test -e native
+#include <unity.h>
+#include "token_bucket.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_unlimited(void) {
+    token_bucket_t tb;
+    token_bucket_init(&tb, 0, 1, 0);
+    token_bucket_take(&tb, 1000000, 0);
+    TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, 0));
+}
+
+static void test_starts_full(void) {
+    token_bucket_t tb;
+    token_bucket_init(&tb, 10, 3, 0);
+
+    // the burst goes out right away, and one more since the bucket is not in debt yet
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, 0));
+        token_bucket_take(&tb, 1, 0);
+    }
+    TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, 0));
+    token_bucket_take(&tb, 1, 0);
+    TEST_ASSERT_EQUAL(100000, token_bucket_delay_us(&tb, 0));
+    TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, 100000));
+}
+
+static void test_steady_rate(void) {
+    token_bucket_t tb;
+    token_bucket_init(&tb, 25, 1, 0);
+
+    // a sender that always waits exactly as told ends up at the rate, after
+    // the full bucket and the first send into debt went out at once
+    int64_t now = 0;
+    for (int i = 0; i < 100; i++) {
+        now += token_bucket_delay_us(&tb, now);
+        token_bucket_take(&tb, 1, now);
+    }
+    TEST_ASSERT_INT64_WITHIN(1, 98 * 40000, now);
+}
+
+static void test_debt_spaces_out_large_sends(void) {
+    token_bucket_t tb;
+    // 1000 bytes per second with a 100 byte burst
+    token_bucket_init(&tb, 1000, 100, 0);
+
+    // larger than the burst still goes out, and the debt covers the time it takes
+    TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, 0));
+    token_bucket_take(&tb, 600, 0);
+    TEST_ASSERT_EQUAL(500000, token_bucket_delay_us(&tb, 0));
+    TEST_ASSERT_EQUAL(250000, token_bucket_delay_us(&tb, 250000));
+    TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, 500000));
+}
+
+static void test_idle_refill_capped_at_burst(void) {
+    token_bucket_t tb;
+    token_bucket_init(&tb, 100, 5, 0);
+    for (int i = 0; i < 5; i++) {
+        token_bucket_take(&tb, 1, 0);
+    }
+
+    // an hour of idling still only allows the burst
+    int64_t now = 3600LL * 1000000;
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, now));
+        token_bucket_take(&tb, 1, now);
+    }
+    TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, now));
+    token_bucket_take(&tb, 1, now);
+    TEST_ASSERT_EQUAL(10000, token_bucket_delay_us(&tb, now));
+}
+
+static void test_time_going_backwards(void) {
+    token_bucket_t tb;
+    token_bucket_init(&tb, 10, 1, 1000000);
+    token_bucket_take(&tb, 1, 1000000);
+    token_bucket_take(&tb, 1, 1000000);
+
+    // an earlier timestamp adds nothing and takes nothing
+    TEST_ASSERT_EQUAL(100000, token_bucket_delay_us(&tb, 500000));
+    TEST_ASSERT_EQUAL(50000, token_bucket_delay_us(&tb, 550000));
+}
+
+static void test_large_rates(void) {
+    token_bucket_t tb;
+    // the most bytes per second the stream code hands in, a 4 GB send must not overflow
+    token_bucket_init(&tb, 0xffffffffu, 0xffffffffu, 0);
+    token_bucket_take(&tb, 0xffffffffu, 0);
+    TEST_ASSERT_EQUAL(0, token_bucket_delay_us(&tb, 0));
+    token_bucket_take(&tb, 0xffffffffu, 0);
+    TEST_ASSERT_EQUAL(1000000, token_bucket_delay_us(&tb, 0));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_unlimited);
+    RUN_TEST(test_starts_full);
+    RUN_TEST(test_steady_rate);
+    RUN_TEST(test_debt_spaces_out_large_sends);
+    RUN_TEST(test_idle_refill_capped_at_burst);
+    RUN_TEST(test_time_going_backwards);
+    RUN_TEST(test_large_rates);
+    return UNITY_END();
+}
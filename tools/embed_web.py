@@ -0,0 +1,146 @@
+# Minify, gzip and embed the web UI in web/ as include/web_assets.h
+#
+# Runs as a PlatformIO pre-script (extra_scripts in platformio.ini) before every build,
+# or by hand with `python tools/embed_web.py`. Assets other than index.html get the
+# first 8 hex digits of their content hash in the file name, so the browser may cache
+# them forever. index.html is rewritten to point at those names and is revalidated
+# with its ETag instead.
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+# Everything together, compressed. The UI shares the radio with the stream, keep it small.
+MAX_TOTAL_BYTES = 16 * 1024
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".svg": "image/svg+xml",
+    ".ico": "image/x-icon",
+}
+
+
+def minify_css(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    text = re.sub(r"\s+", " ", text)
+    text = re.sub(r"\s*([{}:;,>])\s*", r"\1", text)
+    return text.replace(";}", "}").strip()
+
+
+def minify_js(text):
+    # line based on purpose: keeps every line break, so automatic semicolon insertion
+    # behaves exactly as in the source, and never looks inside strings
+    lines = []
+    for line in text.splitlines():
+        line = line.strip()
+        if line and not line.startswith("//"):
+            lines.append(line)
+    return "\n".join(lines)
+
+
+def minify_html(text):
+    text = re.sub(r"<!--.*?-->", "", text, flags=re.S)
+    text = re.sub(r">\s+<", "><", text)
+    text = re.sub(r"\n\s*", "\n", text)
+    return text.strip()
+
+
+MINIFIERS = {".css": minify_css, ".js": minify_js, ".html": minify_html}
+
+
+def short_hash(data):
+    return hashlib.sha256(data).hexdigest()[:8]
+
+
+def c_name(path):
+    return "web_asset_" + re.sub(r"[^A-Za-z0-9]", "_", path.strip("/") or "index")
+
+
+def c_array(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return "\n".join(lines)
+
+
+def load_assets(web_dir):
+    assets = {}
+    for name in sorted(os.listdir(web_dir)):
+        path = os.path.join(web_dir, name)
+        ext = os.path.splitext(name)[1]
+        if not os.path.isfile(path) or ext not in CONTENT_TYPES:
+            continue
+        with open(path, "rb") as f:
+            data = f.read()
+        if ext in MINIFIERS:
+            data = MINIFIERS[ext](data.decode("utf-8")).encode("utf-8")
+        assets[name] = data
+    return assets
+
+
+def build(project_dir):
+    web_dir = os.path.join(project_dir, "web")
+    out_path = os.path.join(project_dir, "include", "web_assets.h")
+
+    assets = load_assets(web_dir)
+    if "index.html" not in assets:
+        sys.exit("embed_web: web/index.html is missing")
+
+    # hashed URLs for everything the page links to
+    urls = {}
+    for name, data in assets.items():
+        if name != "index.html":
+            stem, ext = os.path.splitext(name)
+            urls[name] = "/ui/%s.%s%s" % (stem, short_hash(data), ext)
+
+    index = assets["index.html"].decode("utf-8")
+    for name, url in urls.items():
+        index = index.replace("/ui/" + name, url)
+    assets["index.html"] = index.encode("utf-8")
+    urls["index.html"] = "/"
+
+    entries = []
+    body = []
+    total = 0
+    for name, data in sorted(assets.items()):
+        # mtime 0 keeps the output identical between builds
+        packed = gzip.compress(data, 9, mtime=0)
+        total += len(packed)
+        url = urls[name]
+        var = c_name(url)
+        body.append("static const uint8_t %s[] = {\n%s\n};\n" % (var, c_array(packed)))
+        entries.append('    { "%s", "%s", %s, sizeof(%s), "\\"%s\\"", %s },' % (
+            url, CONTENT_TYPES[os.path.splitext(name)[1]], var, var, short_hash(data),
+            "false" if name == "index.html" else "true"))
+        print("embed_web: %-28s %6d -> %5d bytes" % (url, len(data), len(packed)))
+
+    if total > MAX_TOTAL_BYTES:
+        sys.exit("embed_web: UI is %d bytes compressed, over the %d byte budget" % (total, MAX_TOTAL_BYTES))
+
+    header = (
+        "// Generated by tools/embed_web.py from web/, do not edit\n"
+        "#ifndef WEB_ASSETS_H\n"
+        "#define WEB_ASSETS_H\n\n"
+        "#include \"web_ui.h\"\n\n"
+        "%s\n"
+        "static const web_asset_t web_assets[] = {\n%s\n};\n\n"
+        "#endif // WEB_ASSETS_H\n" % ("\n".join(body), "\n".join(entries)))
+
+    # only touch the file when something changed, so the firmware is not rebuilt for nothing
+    if os.path.exists(out_path):
+        with open(out_path) as f:
+            if f.read() == header:
+                return
+    with open(out_path, "w") as f:
+        f.write(header)
+
+
+try:
+    Import("env")  # noqa: F821, provided by PlatformIO
+    build(env.subst("$PROJECT_DIR"))  # noqa: F821
+except NameError:
+    build(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Self-signed certificate for trying the HTTPS server locally.
+#
+# usage: tools/make_cert.sh [camera-ip-or-hostname ...]
+#
+# Writes certs/cert.pem and certs/key.pem, and include/tls_cert.h which the firmware
+# embeds when built with -DWEB_SERVER_TLS=1. All of them stay out of git.
+# P-256 keeps the handshake a lot cheaper on the ESP32 than RSA would.
+#
+# Check a running camera with
+#   curl --cacert certs/cert.pem https://<ip>/status
+# and session resumption with
+#   openssl s_client -connect <ip>:443 -sess_out /tmp/calicam.sess < /dev/null
+#   openssl s_client -connect <ip>:443 -sess_in /tmp/calicam.sess < /dev/null | grep Reused
+
+set -e
+cd "$(dirname "$0")/.."
+mkdir -p certs include
+
+san="DNS:calicam.local"
+for host in "$@"; do
+    case "$host" in
+        *[!0-9.]*) san="$san,DNS:$host" ;;
+        *)         san="$san,IP:$host" ;;
+    esac
+done
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 825 \
+    -subj "/CN=calicam" -addext "subjectAltName=$san" \
+    -keyout certs/key.pem -out certs/cert.pem 2> /dev/null
+
+pem_to_c() {
+    echo "static const char $1[] ="
+    sed 's/.*/    "&\\n"/' "$2"
+    echo "    ;"
+}
+
+{
+    echo "// Generated by tools/make_cert.sh, do not edit and do not commit"
+    echo "#ifndef TLS_CERT_H"
+    echo "#define TLS_CERT_H"
+    echo
+    pem_to_c tls_cert_pem certs/cert.pem
+    echo
+    pem_to_c tls_key_pem certs/key.pem
+    echo
+    echo "#endif // TLS_CERT_H"
+} > include/tls_cert.h
+
+echo "certificate for $san written to certs/cert.pem and include/tls_cert.h"
@@ -0,0 +1,171 @@
+// CaliCam control UI. Plain JavaScript, no libraries, so the whole UI stays a few kilobytes.
+'use strict';
+
+const $ = (id) => document.getElementById(id);
+
+// Settings shown in the panel: /control key, label, and either [min, max] or a list of options
+const SETTINGS = [
+    ['framesize', 'Frame size', ['96x96', 'QQVGA', 'QCIF', 'HQVGA', '240x240', 'QVGA', 'CIF', 'HVGA', 'VGA', 'SVGA', 'XGA', 'HD', 'SXGA', 'UXGA']],
+    ['quality', 'JPEG quality', [4, 63]],
+    ['brightness', 'Brightness', [-2, 2]],
+    ['contrast', 'Contrast', [-2, 2]],
+    ['saturation', 'Saturation', [-2, 2]],
+    ['special_effect', 'Effect', ['None', 'Negative', 'Grayscale', 'Red', 'Green', 'Blue', 'Sepia']],
+    ['awb', 'Auto white balance', [0, 1]],
+    ['awb_gain', 'AWB gain', [0, 1]],
+    ['wb_mode', 'WB mode', ['Auto', 'Sunny', 'Cloudy', 'Office', 'Home']],
+    ['aec', 'Auto exposure', [0, 1]],
+    ['aec2', 'AEC DSP', [0, 1]],
+    ['ae_level', 'AE level', [-2, 2]],
+    ['aec_value', 'Exposure', [0, 1200]],
+    ['agc', 'Auto gain', [0, 1]],
+    ['agc_gain', 'Gain', [0, 30]],
+    ['gainceiling', 'Gain ceiling', [0, 6]],
+    ['bpc', 'Black pixel corr.', [0, 1]],
+    ['wpc', 'White pixel corr.', [0, 1]],
+    ['raw_gma', 'Raw gamma', [0, 1]],
+    ['lenc', 'Lens correction', [0, 1]],
+    ['hmirror', 'Mirror', [0, 1]],
+    ['vflip', 'Flip', [0, 1]],
+    ['dcw', 'Downsize', [0, 1]],
+    ['colorbar', 'Colour bar', [0, 1]],
+];
+
+async function getJson(url) {
+    const res = await fetch(url);
+    if (!res.ok) {
+        throw new Error(url + ': ' + res.status);
+    }
+    return res.json();
+}
+
+// ---- stream ----
+
+let streaming = false;
+
+function toggleStream() {
+    const img = $('stream');
+    streaming = !streaming;
+    // dropping the src closes the connection, which frees the stream session on the camera
+    img.src = streaming ? `/stream?fps=${$('fps').value}&maxkbps=${$('kbps').value}` : '';
+    $('play').textContent = streaming ? 'Stop' : 'Start';
+}
+
+// ---- settings ----
+
+function buildControls(status) {
+    const box = $('controls');
+    for (const [key, label, range] of SETTINGS) {
+        if (!(key in status)) {
+            continue;
+        }
+        let input;
+        if (typeof range[0] === 'string') {
+            input = document.createElement('select');
+            range.forEach((name, i) => input.add(new Option(name, i)));
+        } else if (range[0] === 0 && range[1] === 1) {
+            input = document.createElement('input');
+            input.type = 'checkbox';
+        } else {
+            input = document.createElement('input');
+            input.type = 'number';
+            input.min = range[0];
+            input.max = range[1];
+        }
+        setInput(input, status[key]);
+        input.onchange = () => setControl(key, input);
+
+        const row = document.createElement('label');
+        row.append(label, input);
+        box.append(row);
+    }
+}
+
+function setInput(input, value) {
+    if (input.type === 'checkbox') {
+        input.checked = !!value;
+    } else {
+        input.value = value;
+    }
+}
+
+async function setControl(key, input) {
+    const val = input.type === 'checkbox' ? (input.checked ? 1 : 0) : input.value;
+    const res = await fetch(`/control?var=${key}&val=${val}`);
+    input.title = res.ok ? 'applied from frame ' + res.headers.get('X-Sequence') : 'failed: ' + res.status;
+}
+
+// ---- histogram ----
+
+let histTimer = null;
+
+async function updateHistogram() {
+    try {
+        const stats = await getJson('/histogram');
+        drawHistogram(stats.hist);
+        $('luma').textContent = `frame ${stats.seq}  mean ${stats.mean}  clipped ${stats.clip_low_pct}% / ${stats.clip_high_pct}%`;
+    } catch (e) {
+        $('luma').textContent = e.message;
+    }
+}
+
+function drawHistogram(hist) {
+    const canvas = $('hist');
+    const ctx = canvas.getContext('2d');
+    const max = Math.max(1, ...hist);
+    const w = canvas.width / hist.length;
+    ctx.clearRect(0, 0, canvas.width, canvas.height);
+    ctx.fillStyle = '#7fb4ff';
+    hist.forEach((count, i) => {
+        const h = count / max * canvas.height;
+        ctx.fillRect(i * w, canvas.height - h, w - 1, h);
+    });
+}
+
+function toggleHistogram() {
+    clearInterval(histTimer);
+    histTimer = $('hist-on').checked ? setInterval(updateHistogram, 1000) : null;
+    if (histTimer) {
+        updateHistogram();
+    }
+}
+
+// ---- registers ----
+
+function logRegister(text) {
+    const log = $('reg-log');
+    log.textContent = text + '\n' + log.textContent;
+}
+
+async function readRegister() {
+    try {
+        const r = await getJson(`/greg?register=${$('reg').value}&mask=${$('mask').value}`);
+        $('val').value = r.masked;
+        logRegister(`read  ${r.reg} & ${r.mask} = ${r.masked}`);
+    } catch (e) {
+        logRegister(e.message);
+    }
+}
+
+async function writeRegister() {
+    try {
+        const r = await getJson(`/sreg?register=${$('reg').value}&mask=${$('mask').value}&value=${$('val').value}`);
+        logRegister(`write ${r.reg} & ${r.mask} = ${r.value}, from frame ${r.seq}`);
+    } catch (e) {
+        logRegister(e.message);
+    }
+}
+
+// ---- start ----
+
+$('play').onclick = toggleStream;
+$('hist-on').onchange = toggleHistogram;
+$('reg-read').onclick = readRegister;
+$('reg-write').onclick = writeRegister;
+
+getJson('/status').then((status) => {
+    $('camera').textContent = `xclk ${status.xclk} MHz`;
+    buildControls(status);
+}).catch((e) => {
+    $('camera').textContent = e.message;
+});